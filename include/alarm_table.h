@@ -0,0 +1,75 @@
+/*
+*Overview: The time alarms compiled into a schedule of the day, one bit per minute that is set when the relay should
+*          be ON (180 bytes for the 1440 minutes). An alarm sets the bits from its ON minute up to the minute before
+*          its OFF minute, wrapping past midnight when OFF is earlier than ON (ON 2200 / OFF 0600 is ON overnight),
+*          and alarms that overlap keep the relay ON for as long as any of them does. The schedule covers one date:
+*          it is rebuilt when an alarm is saved or deleted and when the date changes, with the alarms that run on
+*          that day and the ones whose window carries on from the day before. The state wanted at any minute is a
+*          single bit lookup, so the relay can be put right at boot and on every tick instead of only on the minute
+*          an alarm starts or ends.
+*/
+
+#ifndef ALARM_TABLE_H
+#define ALARM_TABLE_H
+
+#include <stdint.h>
+
+#include "bit_array.h"
+
+/* Minutes in a day, alarm times are stored as minutes since midnight (0-1439) */
+#define MINUTES_PER_DAY 1440
+
+//+ Converts a time of the format HHMM into minutes since midnight
+uint16_t hhmm_to_minute(int hhmm);
+
+//+ Converts minutes since midnight into a time of the format HHMM
+int minute_to_hhmm(uint16_t minute);
+
+//+ A relay switching event
+struct AlarmEvent
+{
+  uint16_t minute;
+  bool relay_on;
+};
+
+class AlarmTable
+{
+public:
+  AlarmTable();
+
+  // Removes all the alarms, the state last reported is kept so the schedule of a new day only switches where it differs
+  void clear();
+
+  // Adds one alarm, with the part of its window that starts today if it runs today and the part that carries on past
+  // midnight from yesterday if it ran yesterday; an alarm whose ON and OFF minutes are the same is ON for 24 hours
+  void add(uint16_t on_minute, uint16_t off_minute, bool runs_today, bool ran_yesterday);
+
+  // Makes the next check() report the state even if it has not changed
+  void resync() { reported = STATE_UNKNOWN; }
+
+  // The relay state the alarms want at minute
+  bool relay_on_at(uint16_t minute) const { return bit_get(minutes, minute); }
+
+  // Checks the current minute, returns true and the new relay state if it differs from the state last reported
+  // (always after resync()); an empty schedule wants the relay OFF
+  bool check(uint16_t now_minute, bool &relay_on);
+
+  // The next change of the relay state after now_minute, returns false if the state never changes
+  bool next_event(uint16_t now_minute, AlarmEvent &event) const;
+
+  uint8_t size() const { return alarm_count; }
+
+private:
+  // check() has not reported a state since resync()
+  static const uint8_t STATE_UNKNOWN = 2;
+
+  void set_window(uint16_t from, uint16_t to);
+
+  uint8_t minutes[BIT_ARRAY_BYTES(MINUTES_PER_DAY)];
+  uint8_t alarm_count;
+
+  // the state last reported by check(), or STATE_UNKNOWN
+  uint8_t reported;
+};
+
+#endif
@@ -0,0 +1,43 @@
+/*
+*Overview: Arrays of single bits packed into bytes, for flags that come one per alarm, setting or minute. Bit i of an
+*          array is bit i % 8 of its byte i / 8.
+*/
+
+#ifndef BIT_ARRAY_H
+#define BIT_ARRAY_H
+
+#include <stdint.h>
+
+/* Bytes needed for an array of the given number of bits */
+#define BIT_ARRAY_BYTES(bits) (((bits) + 7) / 8)
+
+//+ Returns bit index of the array
+inline bool bit_get(const uint8_t *bits, uint16_t index)
+{
+  return (bits[index >> 3] >> (index & 7)) & 1;
+}
+
+//+ Sets or clears bit index of the array
+inline void bit_set(uint8_t *bits, uint16_t index, bool value)
+{
+  uint8_t mask = 1 << (index & 7);
+  if (value)
+  {
+    bits[index >> 3] |= mask;
+  }
+  else
+  {
+    bits[index >> 3] &= ~mask;
+  }
+}
+
+//+ Clears every bit of an array of the given number of bytes
+inline void bit_clear_all(uint8_t *bits, uint16_t bytes)
+{
+  for (uint16_t i = 0; i < bytes; i++)
+  {
+    bits[i] = 0;
+  }
+}
+
+#endif
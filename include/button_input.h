@@ -0,0 +1,91 @@
+/*
+*Overview: Push button events from the debounced levels of the HAL. Every change of the debounced levels comes with the
+*          time it happened, so a press made while loop() is busy is still seen. The presses and releases go into an
+*          event queue; loop() takes one event per pass, which the menus see through the rose()/fell() of the
+*          InputButton objects as they did with Bounce2.
+*/
+
+#ifndef BUTTON_INPUT_H
+#define BUTTON_INPUT_H
+
+#include <stdint.h>
+
+//+ A press (pin went HIGH) or release of the button on pin
+struct ButtonEvent
+{
+  uint8_t pin;
+  bool pressed;
+  unsigned long time_ms;
+};
+
+class ButtonInput
+{
+public:
+  // A power of 2, a full queue drops the newest events
+  static const uint8_t QUEUE_SIZE = 8;
+
+  ButtonInput();
+
+  // Starts watching the pins in pin_mask (bit n is pin n, 0-7) from their current levels
+  void begin(uint8_t pin_mask, uint8_t levels, unsigned long now_ms);
+
+  // Feeds the debounced levels of the pins after a change at time_ms, in the order the changes happened
+  void sample(uint8_t levels, unsigned long time_ms);
+
+  // Takes the next event (if any) as the event of this pass
+  void update(unsigned long now_ms);
+
+  // The event of this pass for pin, the same for every caller until the next update()
+  bool rose(uint8_t pin) const { return has_current && current.pin == pin && current.pressed; }
+  bool fell(uint8_t pin) const { return has_current && current.pin == pin && !current.pressed; }
+
+  // True if the event of this pass is a press of any button, time_ms is when it was debounced
+  bool pressed(unsigned long &time_ms) const
+  {
+    time_ms = current.time_ms;
+    return has_current && current.pressed;
+  }
+
+  // Time since the last press or release of pin, as of the last update()
+  unsigned long duration(uint8_t pin) const { return now - changed_ms[pin]; }
+
+  // Time of the last press or release of any button
+  unsigned long last_activity() const { return activity_ms; }
+
+  // Events dropped because the queue was full
+  uint16_t overflows() const { return dropped; }
+
+private:
+  void push(uint8_t pin, bool pressed, unsigned long time_ms);
+
+  uint8_t mask;
+  uint8_t stable;
+  unsigned long changed_ms[8];
+
+  ButtonEvent queue[QUEUE_SIZE];
+  uint8_t head;
+  uint8_t tail;
+  uint16_t dropped;
+
+  ButtonEvent current;
+  bool has_current;
+  unsigned long now;
+  unsigned long activity_ms;
+};
+
+//+ One button of a ButtonInput with the rose()/fell()/currentDuration() of the Bounce2 library
+class InputButton
+{
+public:
+  InputButton(ButtonInput &input, uint8_t pin) : input(input), pin(pin) {}
+
+  bool rose() const { return input.rose(pin); }
+  bool fell() const { return input.fell(pin); }
+  unsigned long currentDuration() const { return input.duration(pin); }
+
+private:
+  ButtonInput &input;
+  uint8_t pin;
+};
+
+#endif
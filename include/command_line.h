@@ -0,0 +1,47 @@
+/*
+*Overview: Assembles the lines of the serial console one received character at a time into a fixed buffer and splits a
+*          finished line into its words in place, so nothing waits for a whole line and nothing allocates memory.
+*/
+
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+#include <stdint.h>
+
+class CommandLine
+{
+public:
+  // Longest line kept, including the terminating zero; the rest of a longer line is dropped and the line is refused
+  static const uint8_t SIZE = 40;
+
+  static const uint8_t MAX_WORDS = 6;
+
+  CommandLine();
+
+  // Adds a received character, returns true when it ended a line (a CR, a LF or both); the words of that line are
+  // then available until the next call
+  bool feed(char c);
+
+  // Number of words on the finished line, 0 for an empty line
+  uint8_t words() const { return word_count; }
+
+  // A word of the finished line, "" past the last one
+  const char *word(uint8_t index) const { return index < word_count ? buffer + starts[index] : ""; }
+
+  // True if the finished line was longer than SIZE - 1 or had more than MAX_WORDS words
+  bool overflowed() const { return overflow; }
+
+private:
+  void split();
+
+  char buffer[SIZE];
+  uint8_t length;
+  bool overflow;
+  bool last_was_cr;
+  bool finished;
+
+  uint8_t starts[MAX_WORDS];
+  uint8_t word_count;
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*
+*Overview: The persistent settings of the relay, held once in RAM and used directly by the menus and the alarms. Each
+*          field is saved as its own record in the EEPROM log (see ee_journal.h).
+*
+*          The number of time alarms is the one parameter of the layout: the arrays here, the record keys and the
+*          menus all follow it. Set it with a build flag (e.g. build_flags = -DTIME_ALARM_COUNT=40, [env:uno_alarms40]
+*          keeps that building); the checks in main.cpp fail the build if the alarms no longer fit the RAM or the
+*          EEPROM log, which holds at most 40.
+*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+
+#include "bit_array.h"
+
+/* Number of time alarms */
+#ifndef TIME_ALARM_COUNT
+#define TIME_ALARM_COUNT 10
+#endif
+
+static_assert(TIME_ALARM_COUNT >= 1 && TIME_ALARM_COUNT <= 99, "the menus show the number of a time alarm in 2 digits");
+
+/* Raised whenever the meaning of a field or of its log record changes, load_settings() carries the records of the
+earlier versions over (version 1 had no holidays) */
+#define CONFIG_VERSION 2
+
+/* The holiday exceptions, a bit for every day of the calendar (see HalDateTime::calendar_day()) */
+#define HOLIDAY_DAYS 366
+
+/* Weekday mask of an alarm that runs every day, bit 0 is Sunday */
+#define ALL_DAYS 0x7F
+
+/* The holidays are saved as a list of dates, 3 to a record, so a few records hold them instead of the whole bit set */
+#define HOLIDAY_RECORDS 5
+#define HOLIDAYS_PER_RECORD 3
+#define HOLIDAY_MAX (HOLIDAY_RECORDS * HOLIDAYS_PER_RECORD)
+
+/* The record keys of the EEPROM log. The voltage alarm and the version keep the keys they had when there were always
+10 time alarms and the holidays come next, so a log reads back the same whatever the count; the time alarms from the
+11th on come after them. This layout is the one of CONFIG_VERSION 2 and stays: moving a key needs a new version and
+carrying the old records over in load_settings(), as is done for the layouts of version 1 */
+#define VOLT_ALARM_KEY 10
+#define CONFIG_VERSION_KEY 11
+#define HOLIDAY_KEY 12
+#define EXTRA_ALARM_KEY (HOLIDAY_KEY + HOLIDAY_RECORDS)
+#define CONFIG_KEYS (TIME_ALARM_COUNT > 10 ? TIME_ALARM_COUNT - 10 + EXTRA_ALARM_KEY : EXTRA_ALARM_KEY)
+
+struct Config
+{
+  uint8_t version;
+  uint16_t alarm_on[TIME_ALARM_COUNT];                       // minute of the day (0-1439)
+  uint16_t alarm_off[TIME_ALARM_COUNT];                      // minute of the day (0-1439)
+  uint8_t alarm_active[BIT_ARRAY_BYTES(TIME_ALARM_COUNT)];   // bit i is set when time alarm i is active
+  uint8_t alarm_days[TIME_ALARM_COUNT];                      // the days of the week an alarm runs on, bit 0 is Sunday
+  uint16_t volt_on;                                          // decivolts, the relay switches ON at or below it
+  uint16_t volt_off;                                         // decivolts, the relay switches OFF at or above it
+  uint8_t volt_active;
+  uint8_t holidays[BIT_ARRAY_BYTES(HOLIDAY_DAYS)];           // bit d is set when no alarm runs on calendar day d
+} __attribute__((packed));
+
+//+ Returns true if time alarm index is active
+inline bool alarm_is_active(const Config &config, uint8_t index)
+{
+  return bit_get(config.alarm_active, index);
+}
+
+//+ Marks time alarm index as active or not
+inline void set_alarm_active(Config &config, uint8_t index, bool active)
+{
+  bit_set(config.alarm_active, index, active);
+}
+
+//+ The record key of time alarm index
+inline uint8_t time_alarm_key(uint8_t index)
+{
+  return index < VOLT_ALARM_KEY ? index : index - VOLT_ALARM_KEY + EXTRA_ALARM_KEY;
+}
+
+//+ Returns true if calendar day is a holiday
+inline bool is_holiday(const Config &config, uint16_t calendar_day)
+{
+  return bit_get(config.holidays, calendar_day);
+}
+
+#endif
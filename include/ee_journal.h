@@ -0,0 +1,82 @@
+/*
+*Overview: An append-only log of small records in the EEPROM. Every saved setting is written as a new record with a
+*          sequence number and a CRC instead of rewriting it in place, so the writes move across the whole EEPROM and a
+*          power cut while writing only loses the record being written. The EEPROM is split into two banks; when the
+*          bank being written fills up, the newest record of every key is copied into the other bank and the log
+*          carries on there.
+*
+*          Record (8 bytes): sequence number (2 bytes, little endian), 0xA0 + key, 4 data bytes, CRC-8 of the first 7.
+*
+*          The last 8 bytes of the log area are reserved for wear counters: the number of passes started through each
+*          bank (2 x 4 bytes, little endian). Every slot of a bank is written once per pass, so these give the number
+*          of writes of every EEPROM cell in the log.
+*/
+
+#ifndef EE_JOURNAL_H
+#define EE_JOURNAL_H
+
+#include <stdint.h>
+
+#include "config.h"
+#include "hal.h"
+
+/* Size of the data carried by one record */
+#define JOURNAL_DATA_SIZE 4
+
+class EeJournal
+{
+public:
+  static const uint8_t RECORD_SIZE = 8;
+  // Keys 0 to MAX_KEYS - 1 can be stored, one per settings record (a compaction has to fit them all into one bank)
+  static const uint8_t MAX_KEYS = CONFIG_KEYS;
+  static const uint8_t WEAR_SIZE = 8;
+
+  // Number of record slots in each bank of a log of size bytes
+  static constexpr uint8_t bank_slots(int size) { return (size - WEAR_SIZE) / RECORD_SIZE / 2; }
+
+  // The log uses size bytes of the storage from start, the wear counters included
+  EeJournal(HalStorage &storage, int start, int size);
+
+  // Scans the log for the newest record of every key, returns the number of keys found
+  uint8_t begin();
+
+  // Copies the newest data stored for key, returns false if the key has never been written
+  bool read(uint8_t key, uint8_t *data);
+
+  // Appends a record for key (compacting first if the bank is full), unchanged data is not written again
+  void write(uint8_t key, const uint8_t *data);
+
+  // Number of records appended since begin(), compactions included
+  uint16_t writes() const { return records_written; }
+
+  // Number of slots the log holds (8 EEPROM bytes each)
+  uint8_t slots() const { return slots_per_bank * 2; }
+
+  // Number of passes started through a bank (0 or 1)
+  uint32_t bank_passes(uint8_t which) const { return passes[which]; }
+
+  // Number of times the record slot (and so each of its 8 EEPROM cells) has been written
+  uint32_t slot_writes(uint8_t slot) const;
+
+private:
+  bool read_record(uint8_t slot, uint16_t &seq, uint8_t &key, uint8_t *data);
+  void write_record(uint8_t slot, uint8_t key, const uint8_t *data);
+  void append(uint8_t key, const uint8_t *data);
+  void compact();
+  void start_pass(uint8_t which);
+
+  uint8_t bank_of(uint8_t slot) const { return slot / slots_per_bank; }
+
+  HalStorage &storage;
+  int start;
+  uint8_t slots_per_bank;
+
+  int8_t latest[MAX_KEYS]; // slot of the newest record of each key, -1 if none
+  uint8_t bank;            // the bank being written, 0 or 1
+  uint8_t head;            // the next slot to write
+  uint16_t next_seq;
+  uint16_t records_written;
+  uint32_t passes[2];
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+*Overview: The EEPROM bytes waiting to be written in the background, oldest first. An EEPROM byte takes about 3.3ms to
+*          write, so writes are queued here and drained one at a time when the EEPROM is ready. Reads look here first,
+*          so a byte reads back as its newest value even before it has reached the EEPROM.
+*/
+
+#ifndef EEPROM_QUEUE_H
+#define EEPROM_QUEUE_H
+
+#include <stdint.h>
+
+class EepromQueue
+{
+public:
+  // A power of 2; a saved setting is 8 bytes, only a compaction of the settings log has to wait for room
+  static const uint8_t SIZE = 64;
+
+  EepromQueue()
+  {
+    head = 0;
+    tail = 0;
+  }
+
+  bool empty() const { return head == tail; }
+  bool full() const { return (uint8_t)(head - tail) == SIZE; }
+  uint8_t size() const { return head - tail; }
+
+  // Adds a write, returns false if the queue is full
+  bool push(uint16_t address, uint8_t value)
+  {
+    if (full())
+    {
+      return false;
+    }
+    addresses[head & (SIZE - 1)] = address;
+    values[head & (SIZE - 1)] = value;
+    head++;
+    return true;
+  }
+
+  // Removes the oldest write, returns false if there is none
+  bool pop(uint16_t &address, uint8_t &value)
+  {
+    if (empty())
+    {
+      return false;
+    }
+    address = addresses[tail & (SIZE - 1)];
+    value = values[tail & (SIZE - 1)];
+    tail++;
+    return true;
+  }
+
+  // The newest value queued for address, returns false if nothing is queued for it
+  bool find(uint16_t address, uint8_t &value) const
+  {
+    for (uint8_t i = head; i != tail; i--)
+    {
+      uint8_t index = (i - 1) & (SIZE - 1);
+      if (addresses[index] == address)
+      {
+        value = values[index];
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  uint16_t addresses[SIZE];
+  uint8_t values[SIZE];
+  // free running counters, the difference is the number of queued writes
+  volatile uint8_t head;
+  volatile uint8_t tail;
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*
+*Overview: Thin hardware abstraction layer used by the relay firmware. Everything in main.cpp that touches hardware
+*          (the LCD, the DS1307 RTC, the EEPROM, the ADC, the GPIO pins, the buttons and the serial port) goes through
+*          the declarations in this file. hal_avr.cpp wraps the Arduino libraries for the Uno and host/hal_native.cpp
+*          provides simulated hardware so the same firmware can be built and profiled on a PC ([env:native]).
+*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+// The few pieces of the Arduino core that the firmware uses directly
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define memcpy_P(dst, src, size) memcpy((dst), (src), (size))
+#define PSTR(string_literal) (string_literal)
+#define strcmp_P(str, pstr) strcmp((str), (pstr))
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define A0 14
+#define A1 15
+#endif
+
+/* The cycle counter is only built for the loop() profiler and the kernel benchmarks */
+#if defined(LOOP_PROFILE) || defined(KERNEL_BENCH)
+#define HAL_CYCLES
+#endif
+
+/*
+? START TIMING
+*/
+unsigned long hal_millis();
+unsigned long hal_micros();
+void hal_delay(unsigned long ms);
+void hal_delay_us(unsigned int us);
+
+#ifdef HAL_CYCLES
+// Starts a free running count of CPU cycles (Timer1 on the Uno, which is then no longer available for PWM)
+void hal_cycles_begin();
+
+// CPU cycles since hal_cycles_begin(), stands still while powered down
+uint32_t hal_cycles();
+#endif
+
+#ifdef KERNEL_BENCH
+// Fills the free stack below the caller with a pattern
+void hal_stack_paint();
+
+// Bytes of stack below the caller of hal_stack_paint() that have been written since (by calls and by interrupts)
+uint16_t hal_stack_used();
+#endif
+/*
+? END TIMING
+*/
+
+/*
+? START GPIO AND ADC
+*/
+void hal_gpio_mode(uint8_t pin, uint8_t mode);
+void hal_gpio_write(uint8_t pin, uint8_t level);
+uint8_t hal_gpio_read(uint8_t pin);
+
+// PWM output (used to dim the LCD backlight)
+void hal_gpio_pwm(uint8_t pin, uint8_t duty);
+
+// Starts sampling the analog pin continuously into a ring buffer (about 1kHz, driven by interrupts on the Uno)
+void hal_adc_start(uint8_t pin);
+
+// Running average of the latest non-zero 10-bit samples, 0 if there are none; always ready
+uint16_t hal_adc_average();
+/*
+? END GPIO AND ADC
+*/
+
+/*
+? START DISPLAY
+*/
+//+ Counters of the queue between the firmware and the display bus
+struct HalBusStats
+{
+  uint8_t depth;      // bytes waiting to be sent
+  uint8_t peak;       // the most bytes that have ever been waiting
+  uint8_t capacity;   // size of the queue in bytes (0 when writes are sent straight away)
+  uint16_t overflows; // writes dropped because the queue was full
+  uint16_t errors;    // writes that failed on the bus
+};
+
+//+ 16x2 HD44780 character display (behind a PCF8574 I2C backpack on the Uno)
+// Formatting is done by LcdBuffer, the display only takes single characters and commands.
+class HalDisplay
+{
+public:
+  void begin(uint8_t cols, uint8_t rows);
+  void clear();
+  void setCursor(uint8_t col, uint8_t row);
+  void cursor();
+  void noCursor();
+  void write(char c);
+
+  // True if a cursor move and a character can be queued without dropping anything
+  bool ready();
+
+  HalBusStats bus_stats();
+};
+/*
+? END DISPLAY
+*/
+
+/*
+? START CLOCK
+*/
+//+ A calendar date and time, with the accessors used by RTClib's DateTime
+class HalDateTime
+{
+public:
+  HalDateTime(uint16_t year = 2000, uint8_t month = 1, uint8_t day = 1, uint8_t hour = 0, uint8_t minute = 0, uint8_t second = 0);
+
+  // Builds the datetime from seconds since 1 Jan 2000 00:00:00
+  static HalDateTime from_seconds(uint32_t seconds);
+
+  // The date & time this sketch was compiled
+  static HalDateTime build_time();
+
+  uint16_t year() const { return yOff + 2000; }
+  uint8_t month() const { return m; }
+  uint8_t day() const { return d; }
+  uint8_t hour() const { return hh; }
+  uint8_t minute() const { return mm; }
+  uint8_t second() const { return ss; }
+
+  // Seconds since 1 Jan 2000 00:00:00
+  uint32_t seconds() const;
+
+  // Day of the week, 0 is Sunday
+  uint8_t dayOfTheWeek() const;
+
+  // Day of the year counted as in a leap year (0-365), so a date has the same number every year (1 Mar is always 60)
+  uint16_t calendar_day() const;
+  bool isValid() const;
+
+private:
+  uint8_t yOff;
+  uint8_t m;
+  uint8_t d;
+  uint8_t hh;
+  uint8_t mm;
+  uint8_t ss;
+};
+
+//+ The battery backed real time clock (a DS1307 on the Uno)
+class HalClock
+{
+public:
+  bool begin();
+  bool isrunning();
+  HalDateTime now();
+  void adjust(const HalDateTime &dt);
+
+  // Switches the 1Hz square wave output on or off, its falling edge is the start of each RTC second
+  void square_wave(bool enable);
+};
+/*
+? END CLOCK
+*/
+
+/*
+? START STORAGE
+*/
+//+ Byte addressable non-volatile storage (the internal EEPROM on the Uno)
+// Writes are queued and done in the background, a read returns the newest value even while its write is queued.
+class HalStorage
+{
+public:
+  uint8_t read(int address);
+
+  // Queues a write of the byte if it differs from the stored one, only waits when the queue is full
+  void update(int address, uint8_t value);
+
+  // True while queued writes have not reached the storage yet
+  bool pending();
+
+  // Waits until every queued write is done
+  void flush();
+
+  int length();
+
+  template <typename T>
+  T &get(int address, T &t)
+  {
+    uint8_t *ptr = (uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+      ptr[i] = read(address + i);
+    }
+    return t;
+  }
+
+  template <typename T>
+  const T &put(int address, const T &t)
+  {
+    const uint8_t *ptr = (const uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++)
+    {
+      update(address + i, ptr[i]);
+    }
+    return t;
+  }
+};
+/*
+? END STORAGE
+*/
+
+/*
+? START BUTTONS
+*/
+//+ The debounced levels of the button pins (bit n is pin n, pins 0-7 are PORTD on the Uno) and when they changed
+struct HalInputSample
+{
+  uint8_t levels;
+  unsigned long time_ms;
+};
+
+/* The button pins are sampled every HAL_INPUT_SAMPLE_MS from a timer interrupt, and debounced over
+VerticalDebounce::SAMPLES samples (about 50ms) */
+#define HAL_INPUT_SAMPLE_MS 6
+
+// Makes the pins in pin_mask inputs and starts debouncing them
+void hal_input_begin(uint8_t pin_mask);
+
+// The debounced levels of the button pins now
+uint8_t hal_input_levels();
+
+// Takes the oldest change of the debounced levels, returns false if there is none (when the changes pile up the
+// newest one is kept up to date)
+bool hal_input_next(HalInputSample &sample);
+/*
+? END BUTTONS
+*/
+
+/*
+? START POWER
+*/
+/* Why hal_sleep() returned */
+#define HAL_WAKE_TICK 0    // the RTC square wave started a new second
+#define HAL_WAKE_BUTTON 1  // a button pin changed
+#define HAL_WAKE_TIMEOUT 2 // no tick came within HAL_SLEEP_TIMEOUT_MS (the square wave is not wired up)
+#define HAL_WAKE_SERIAL 3  // the serial port started receiving, the character that woke the MCU is lost
+
+/* The longest hal_sleep() waits for a tick (the watchdog on the Uno) */
+#define HAL_SLEEP_TIMEOUT_MS 2000
+
+// Makes the pin that the RTC square wave output is wired to (open drain, one of A0-A5 on the Uno) an input with its
+// pull up, and the wake up source of hal_sleep()
+void hal_sleep_begin(uint8_t sqw_pin);
+
+// Finishes the background writes and powers the MCU down until the next RTC tick, a change of a button pin (those
+// given to hal_input_begin()), serial input or the timeout. millis() stands still while powered down: after a tick it
+// is moved on to at least tick_ms (the caller's estimate of the millis() of the tick, so the time the writes took is
+// not counted twice), after a timeout to HAL_SLEEP_TIMEOUT_MS past the start of the power down, and after a button or
+// serial input it is left as it is since there is no telling when that came
+uint8_t hal_sleep(unsigned long tick_ms);
+/*
+? END POWER
+*/
+
+/*
+? START SERIAL
+*/
+class HalSerial
+{
+public:
+  void begin(unsigned long baud);
+  void flush();
+
+  // Bytes received and not read yet
+  int available();
+
+  // The next received byte, -1 if there is none
+  int read();
+
+  // Bytes that can be printed without waiting for the transmit buffer
+  int availableForWrite();
+
+  size_t print(const __FlashStringHelper *str);
+  size_t print(const char *str);
+  size_t print(long value);
+  size_t println(const __FlashStringHelper *str);
+  size_t println(const char *str);
+  size_t println(long value);
+  size_t println();
+};
+/*
+? END SERIAL
+*/
+
+#endif
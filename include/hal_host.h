@@ -0,0 +1,72 @@
+/*
+*Overview: Controls for the simulated hardware behind the host implementation of the HAL (host/hal_native.cpp).
+*          Only available in the host builds; the host entry points use it to drive the firmware.
+*/
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#ifdef ARDUINO
+#error "hal_host.h is only available in the host builds"
+#endif
+
+#include "hal.h"
+
+/* The firmware entry points defined in main.cpp */
+void setup();
+void loop();
+
+// Advances the virtual time seen through hal_millis()/hal_micros() and the RTC
+void host_advance_us(unsigned long us);
+
+// Sets the datetime of the simulated RTC
+void host_set_datetime(const HalDateTime &dt);
+
+// Makes the simulated RTC run fast (positive) or slow (negative) relative to the virtual time, in ppm
+void host_set_rtc_drift(long ppm);
+
+// Sets the 10-bit value that the ADC samples on the given pin
+void host_set_adc(uint8_t pin, int value);
+
+// Sets the electrical level of an input pin (buttons read HIGH when pressed)
+void host_set_pin(uint8_t pin, uint8_t level);
+
+// Schedules a change of an input pin delay_us from now, it also wakes the firmware from a power down; returns false
+// when too many changes are already waiting
+bool host_set_pin_at(uint8_t pin, uint8_t level, unsigned long delay_us);
+
+// The last level written to an output pin through hal_gpio_write()/hal_gpio_pwm()
+uint8_t host_get_pin(uint8_t pin);
+
+// Queues text to be read by the firmware from the serial port, returns false if it did not all fit
+bool host_serial_input(const char *text);
+
+// Keeps what the firmware prints over serial for host_serial_line() instead of writing it to stdout
+void host_capture_serial(bool enable);
+
+// Takes the oldest complete line printed over serial while capturing, without the line ending; false if there is none
+bool host_serial_line(char *line, size_t size);
+
+// The characters currently shown on a row of the simulated 16x2 display
+const char *host_lcd_row(uint8_t row);
+
+// Number of bytes written to the display since start up
+unsigned long host_lcd_writes();
+
+// Number of EEPROM bytes actually written (erased and programmed) since start up
+unsigned long host_eeprom_writes();
+
+// Prints a line for every power down in hal_sleep(): when, how long and what woke the firmware
+void host_trace_power(bool enable);
+
+// Calls hook at the start of every power down in hal_sleep(), before the virtual time jumps, so what the pass did can
+// be looked at with the time it happened at (NULL for none)
+void host_on_power_down(void (*hook)());
+
+// Virtual time spent powered down since start up
+unsigned long long host_asleep_us();
+
+// The virtual time since start up, which keeps running while millis() stands still in a power down
+unsigned long long host_time_us();
+
+#endif
@@ -0,0 +1,44 @@
+/*
+*Overview: Interrupt driven I2C master for the Uno. Writes are copied into a ring buffer and sent from the TWI interrupt,
+*          so callers return straight away and the bus transfers overlap with the rest of loop(). Reads (only used for
+*          the DS1307) wait for the queue to drain and are then done directly.
+*/
+
+#ifndef I2C_ASYNC_H
+#define I2C_ASYNC_H
+
+#include <stdint.h>
+
+/* Size of the transmit queue in bytes (a power of 2), each write takes its length plus 2 bytes */
+#define I2C_QUEUE_SIZE 128
+
+//+ Counters for sizing the transmit queue
+struct I2cQueueStats
+{
+  uint8_t depth;      // bytes waiting in the queue
+  uint8_t peak;       // the most bytes that have ever been waiting
+  uint16_t overflows; // writes dropped because the queue was full
+  uint16_t errors;    // writes that were not acknowledged or lost the bus
+};
+
+// Sets up the TWI hardware, clock_hz is the SCL frequency (later calls are ignored)
+void i2c_async_begin(uint32_t clock_hz);
+
+// Queues a write of length bytes to the 7-bit address, returns false (and counts an overflow) if it does not fit
+bool i2c_async_write(uint8_t address, const uint8_t *data, uint8_t length);
+
+// Free space in the queue in bytes
+uint8_t i2c_async_room();
+
+// Blocks until every queued write has been sent
+void i2c_async_flush();
+
+// Reads length bytes starting at register reg, blocking; returns false on a bus error
+bool i2c_read_registers(uint8_t address, uint8_t reg, uint8_t *data, uint8_t length);
+
+// Returns true if a device acknowledges the address
+bool i2c_probe(uint8_t address);
+
+I2cQueueStats i2c_async_stats();
+
+#endif
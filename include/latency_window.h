@@ -0,0 +1,39 @@
+/*
+*Overview: A rolling window of the latest latency measurements (in milliseconds) with percentiles over it. Adding a
+*          measurement is a store into a ring; the percentiles sort a copy of the window, so they are only worked out
+*          when they are shown.
+*/
+
+#ifndef LATENCY_WINDOW_H
+#define LATENCY_WINDOW_H
+
+#include <stdint.h>
+
+class LatencyWindow
+{
+public:
+  // A power of 2, each measurement takes 2 bytes
+  static const uint8_t SIZE = 32;
+
+  LatencyWindow();
+
+  // Replaces the oldest measurement, longer than 65535ms is kept as 65535ms
+  void add(unsigned long ms);
+
+  // Number of measurements in the window
+  uint8_t count() const { return filled; }
+
+  // Number of measurements added so far, wrapping at 256, so it changes whenever the window does
+  uint8_t added() const { return total; }
+
+  // The p-th percentile (0-100, nearest rank) of the window, 0 while it is empty
+  uint16_t percentile(uint8_t p) const;
+
+private:
+  uint16_t samples[SIZE];
+  uint8_t next;
+  uint8_t filled;
+  uint8_t total;
+};
+
+#endif
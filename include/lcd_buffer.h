@@ -0,0 +1,59 @@
+/*
+*Overview: A shadow framebuffer for the 16x2 LCD. The screens draw into a 32 byte frame using the same calls as the
+*          LiquidCrystal library, and flush() sends only the cells that differ from what the display already shows
+*          (plus the cursor moves needed to reach them). Redrawing an unchanged screen therefore costs no I2C traffic.
+*/
+
+#ifndef LCD_BUFFER_H
+#define LCD_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hal.h"
+
+class LcdBuffer
+{
+public:
+  static const uint8_t COLS = 16;
+  static const uint8_t ROWS = 2;
+
+  LcdBuffer(HalDisplay &display);
+
+  void begin();
+
+  // Drawing into the frame, nothing is sent to the display until flush()
+  void clear();
+  void setCursor(uint8_t col, uint8_t row);
+  void cursor();
+  void noCursor();
+
+  size_t print(const __FlashStringHelper *str);
+  size_t print(const char *str);
+  size_t print(char c);
+  size_t print(int value);
+
+  // Sends the changed cells and the cursor state to the display, returns the number of cells sent
+  uint8_t flush();
+
+private:
+  void put(char c);
+
+  HalDisplay &display;
+
+  // what the screens have drawn and what the display is showing
+  char frame[ROWS][COLS];
+  char shown[ROWS][COLS];
+
+  // the drawing position and cursor as set by the screens
+  uint8_t col;
+  uint8_t row;
+  bool cursor_on;
+
+  // the address and cursor of the display itself
+  uint8_t display_col;
+  uint8_t display_row;
+  bool display_cursor_on;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+*Overview: Per stage timing of loop(), only compiled in when LOOP_PROFILE is defined ([env:uno_profile]). Each stage
+*          of a pass is timed in CPU cycles with hal_cycles() and kept as min/max/mean plus a log2 histogram, and the
+*          table is printed over serial on request (the profile command of the console). Without LOOP_PROFILE the
+*          PROFILE_ macros expand to nothing and none of this is built, so the normal firmware carries no code or RAM
+*          for it.
+*/
+
+#ifndef LOOP_PROFILE_H
+#define LOOP_PROFILE_H
+
+#include <stdint.h>
+
+#include "hal.h"
+
+/* The stages of a pass of loop(), in the order they run */
+#define STAGE_CLOCK 0   // software clock update and its RTC re-sync
+#define STAGE_BUTTONS 1 // button events
+#define STAGE_JOBS 2    // scheduled jobs: alarms, voltage sampling, the idle screen
+#define STAGE_MENU 3    // the menu state machine and its programs (including the settings writes)
+#define STAGE_DISPLAY 4 // sending the changed cells to the LCD
+#define STAGE_SLEEP 5   // power down, only the awake part is counted as the cycle counter stops
+#define STAGE_PASS 6    // a whole pass, from the start of one to the start of the next
+#define PROFILE_STAGES 7
+
+#ifdef LOOP_PROFILE
+
+class LoopProfile
+{
+public:
+  // Buckets of the histogram: bucket n counts the times of 2^(n + FIRST_BUCKET) to 2^(n + FIRST_BUCKET + 1)-1 cycles,
+  // the first one everything shorter and the last one (2^19 cycles, 33ms on the Uno) everything longer
+  static const uint8_t FIRST_BUCKET = 4;
+  static const uint8_t BUCKETS = 16;
+
+  // Starts the cycle counter and clears the statistics
+  void begin();
+
+  // The start of a pass, ends the previous one
+  void start();
+
+  // The end of a stage, which began where the previous stage (or the pass) ended
+  void stage(uint8_t stage);
+
+  // Prints line number line of the table over serial (a heading, then a line per stage), returns false past the end;
+  // the pass it is printed from is left out of the statistics
+  bool print_line(HalSerial &serial, uint8_t line);
+
+  // Clears the statistics
+  void reset();
+
+private:
+  struct Stats
+  {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t histogram[BUCKETS];
+  };
+
+  void record(uint8_t stage, uint32_t cycles);
+
+  Stats stats[PROFILE_STAGES];
+
+  // the cost of taking a timestamp, taken off every measurement
+  uint32_t overhead;
+
+  uint32_t pass_start;
+  uint32_t stage_start;
+  bool skip_pass;
+};
+
+extern LoopProfile loop_profile;
+
+#define PROFILE_BEGIN() loop_profile.begin()
+#define PROFILE_START() loop_profile.start()
+#define PROFILE_STAGE(id) loop_profile.stage(id)
+
+#else
+
+#define PROFILE_BEGIN()
+#define PROFILE_START()
+#define PROFILE_STAGE(id)
+
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+/*
+*Overview: The menus as a table of states kept in flash. Each state lists the state every button leads to, the two
+*          lines shown when the state is entered, and optionally a program that runs on every pass while in the state
+*          (e.g. the alarm editors). Adding a menu entry is adding a row.
+*/
+
+#ifndef MENU_TABLE_H
+#define MENU_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hal.h"
+
+/* A button target that leaves the state as it is */
+#define MENU_STAY 0xFF
+
+/* One line of the 16 character display, including the terminating zero */
+#define MENU_LABEL_SIZE 17
+
+typedef void (*MenuProgram)();
+
+struct MenuState
+{
+  // the state each button leads to, MENU_STAY to ignore the button
+  uint8_t up;
+  uint8_t down;
+  uint8_t left;
+  uint8_t right;
+  uint8_t ok;
+  uint8_t back;
+
+  // shown when the state is entered, nothing is drawn if the first line is empty
+  char line0[MENU_LABEL_SIZE];
+  char line1[MENU_LABEL_SIZE];
+
+  // runs on every pass while in the state, before the buttons are checked (0 for none)
+  MenuProgram program;
+};
+
+//+ Copies row index of a menu table in flash into RAM
+inline void read_menu_state(const MenuState *table, uint8_t index, MenuState &row)
+{
+  memcpy_P(&row, &table[index], sizeof(MenuState));
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+*Overview: A ring buffer of the latest ADC samples with a running sum, so the average is always ready without looping
+*          over the samples. Zero readings are kept out of the average, as measure_voltage() always did.
+*/
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+
+class SampleRing
+{
+public:
+  // A power of 2 so the full ring average is a shift; 16 samples of 10 bits fit the 16-bit sum
+  static const uint8_t SIZE = 16;
+
+  SampleRing()
+  {
+    for (uint8_t i = 0; i < SIZE; i++)
+    {
+      samples[i] = 0;
+    }
+    sum = 0;
+    valid = 0;
+    index = 0;
+  }
+
+  // Replaces the oldest sample
+  void add(uint16_t sample)
+  {
+    uint16_t oldest = samples[index];
+    if (oldest != 0)
+    {
+      sum -= oldest;
+      valid--;
+    }
+    if (sample != 0)
+    {
+      sum += sample;
+      valid++;
+    }
+    samples[index] = sample;
+    index = (index + 1) & (SIZE - 1);
+  }
+
+  // Average of the non-zero samples, 0 if every sample read 0
+  uint16_t average() const
+  {
+    if (valid == SIZE)
+    {
+      return sum / SIZE;
+    }
+    return valid == 0 ? 0 : sum / valid;
+  }
+
+private:
+  uint16_t samples[SIZE];
+  uint16_t sum;
+  uint8_t valid;
+  uint8_t index;
+};
+
+#endif
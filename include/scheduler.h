@@ -0,0 +1,47 @@
+/*
+*Overview: A small cooperative scheduler for the jobs in loop(). A job either runs once every period (measured with
+*          hal_millis()) or once on each clock tick it listens to (the edges of the RTC seconds and minutes). Jobs must
+*          return quickly since nothing in loop() is allowed to block.
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+/* Clock edges raised by the main loop and passed to Scheduler::run() */
+#define TICK_SECOND 0x01
+#define TICK_MINUTE 0x02
+
+class Scheduler
+{
+public:
+  typedef void (*Job)();
+
+  Scheduler();
+
+  // Runs the job once every period_ms, returns false if the job table is full
+  bool every(unsigned long period_ms, Job job);
+
+  // Runs the job once on every tick that matches the mask, returns false if the job table is full
+  bool on_tick(uint8_t tick_mask, Job job);
+
+  // Runs every job that is due, ticks is the set of clock edges seen on this pass
+  void run(unsigned long now_ms, uint8_t ticks);
+
+private:
+  static const uint8_t MAX_JOBS = 6;
+
+  struct Entry
+  {
+    Job job;
+    unsigned long period_ms;
+    unsigned long last_ms;
+    uint8_t tick_mask;
+  };
+
+  Entry jobs[MAX_JOBS];
+  uint8_t job_count;
+};
+
+#endif
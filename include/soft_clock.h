@@ -0,0 +1,88 @@
+/*
+*Overview: A millis() based software clock disciplined by the DS1307. The RTC is read once at start up and then once a
+*          minute; each re-sync waits for the RTC seconds edge so the clock is phase locked to it, and the measured
+*          difference between the RTC and millis() is kept as a drift correction (in ppm). Everything else in the
+*          firmware takes its timestamps from here instead of doing an I2C read. While the MCU is powered down
+*          between the ticks of the RTC square wave, each tick is taken as a seconds edge in between, but the RTC is still
+*          read once a minute so a missed tick does not leave the clock out for good.
+*/
+
+#ifndef SOFT_CLOCK_H
+#define SOFT_CLOCK_H
+
+#include <stdint.h>
+
+#include "hal.h"
+
+class SoftClock
+{
+public:
+  SoftClock();
+
+  // Reads the RTC and starts looking for its next seconds edge
+  void begin(HalClock &rtc);
+
+  // Re-syncs with the RTC when it is due; call on every pass of loop()
+  void update(unsigned long now_ms);
+
+  // The current datetime, computed from hal_millis()
+  HalDateTime now();
+
+  // Seconds since 1 Jan 2000 00:00:00
+  uint32_t seconds();
+
+  // Sets the RTC and the software clock to the given datetime
+  void adjust(const HalDateTime &dt);
+
+  // The measured rate of the RTC relative to millis(), in parts per million
+  int32_t drift_ppm() const { return drift; }
+
+  // True once the clock has been phase locked to the RTC seconds edge
+  bool locked() const { return is_locked; }
+
+  // Milliseconds until the next RTC seconds edge, 0 if the clock is not trimmed yet or the edge could be too close
+  // on either side of now to tell which second it starts
+  uint16_t ms_to_edge(unsigned long now_ms) const;
+
+  // An RTC seconds edge (the square wave tick) at now_ms, that starts the given second
+  void second_edge(unsigned long now_ms, uint32_t second);
+
+  // Looks for the next RTC seconds edge straight away without measuring the drift over it, after millis() stood
+  // still for an unknown time
+  void resync(unsigned long now_ms);
+
+private:
+  // Corrected milliseconds elapsed since the base
+  uint32_t elapsed_ms(unsigned long now_ms) const;
+  // Corrects raw milliseconds for the drift
+  uint32_t corrected(uint32_t raw_ms) const;
+  void start_sync(unsigned long now_ms);
+  void rebase(unsigned long now_ms);
+  void mark_synced();
+
+  HalClock *rtc;
+
+  // The clock is base_seconds at base_ms
+  uint32_t base_seconds;
+  unsigned long base_ms;
+
+  // When the RTC was last read for a sync, the next one is due a minute after it
+  unsigned long synced_ms;
+  // The base is a square wave tick rather than an edge found by reading the RTC
+  bool on_tick;
+
+  int32_t drift;
+  bool is_trimmed;
+  bool is_locked;
+
+  // state of the edge search
+  bool syncing;
+  unsigned long sync_start_ms;
+  uint8_t sync_second;
+
+  // the last datetime handed out, to avoid converting on every call
+  uint32_t cached_seconds;
+  HalDateTime cached;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+*Overview: Fixed size text helpers that replace the Arduino String class. Everything is written into buffers owned by
+*          the caller, so nothing here allocates memory.
+*/
+
+#ifndef TEXT_FORMAT_H
+#define TEXT_FORMAT_H
+
+#include <stdint.h>
+
+/* Sizes of the text buffers, including the terminating zero */
+#define TIME_TEXT_SIZE 5 // HHMM
+#define VOLT_TEXT_SIZE 5 // XX.Y
+#define DAYS_TEXT_SIZE 8 // SMTWTFS
+
+//+ The character for a single decimal digit
+inline char digit_char(int digit)
+{
+  return '0' + digit;
+}
+
+//+ The value of a decimal digit character (non digits count as 0)
+inline int digit_value(char c)
+{
+  return (c >= '0' && c <= '9') ? c - '0' : 0;
+}
+
+//+ Writes value as exactly width decimal digits (zero padded) followed by a terminating zero
+void format_uint(char *dst, uint16_t value, uint8_t width);
+
+//+ Writes the 4 digits of a time entry as HHMM
+void format_time_digits(char *dst, const int *digits);
+
+//+ Writes the digits of a voltage entry as XX.Y (index 2 of the digits is the unused period position)
+void format_volt_digits(char *dst, const int *digits);
+
+//+ Writes a voltage in decivolts (0-999) as XX.Y
+void format_decivolts(char *dst, uint16_t decivolts);
+
+//+ Writes the days of a weekday mask (bit 0 is Sunday) as SMTWTFS, with a - for each day that is not in it
+void format_days(char *dst, uint8_t days);
+
+//+ Reads a weekday mask written as by format_days(), returns false if str is not 7 such characters
+bool parse_days(const char *str, uint8_t &days);
+
+//+ Reads the digits of str as one number, skipping anything that is not a digit (e.g. "12.5" gives 125)
+int parse_digits(const char *str);
+
+//+ Reads count fields of decimal digits separated by separator (e.g. "2022-01-05" is 3 fields with '-'); returns false
+// unless str is exactly that, with every field 1 to 5 digits and below 65536
+bool parse_fields(const char *str, char separator, uint16_t *fields, uint8_t count);
+
+//+ Reads a voltage written as XX.Y or as whole volts into decivolts, returns false if str is neither
+bool parse_decivolts(const char *str, uint16_t &decivolts);
+
+//+ Copies a text field of size bytes, always leaving it terminated
+void copy_text(char *dst, const char *src, uint8_t size);
+
+#endif
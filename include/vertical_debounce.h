@@ -0,0 +1,58 @@
+/*
+*Overview: Debounces 8 pins at once with vertical counters: a 3-bit counter per pin, held as one bit of each of three
+*          bytes, so every pin is counted by the same few bitwise operations. A pin changes its debounced level after
+*          8 samples in a row that differ from it; any sample that agrees resets its counter.
+*/
+
+#ifndef VERTICAL_DEBOUNCE_H
+#define VERTICAL_DEBOUNCE_H
+
+#include <stdint.h>
+
+class VerticalDebounce
+{
+public:
+  // Number of samples in a row a pin has to hold its new level for
+  static const uint8_t SAMPLES = 8;
+
+  VerticalDebounce() { begin(0); }
+
+  void begin(uint8_t levels)
+  {
+    state = levels;
+    count0 = 0;
+    count1 = 0;
+    count2 = 0;
+  }
+
+  // Takes one sample of the 8 pins, returns the pins whose debounced level changed
+  uint8_t sample(uint8_t raw)
+  {
+    uint8_t delta = raw ^ state;
+
+    // the pins whose counter is at 7 and still differ change now (the counter wraps to 0)
+    uint8_t toggle = delta & count0 & count1 & count2;
+
+    // counting up where the pin differs, back to 0 where it agrees
+    count2 = (count2 ^ (count1 & count0)) & delta;
+    count1 = (count1 ^ count0) & delta;
+    count0 = ~count0 & delta;
+
+    state ^= toggle;
+    return toggle;
+  }
+
+  // The debounced levels
+  uint8_t levels() const { return state; }
+
+  // True while no pin is part way through changing
+  bool idle() const { return (count0 | count1 | count2) == 0; }
+
+private:
+  uint8_t state;
+  uint8_t count0;
+  uint8_t count1;
+  uint8_t count2;
+};
+
+#endif
@@ -0,0 +1,35 @@
+/*
+*Overview: Fixed point conversion between raw ADC counts and the voltage in decivolts (tenths of a volt, e.g. 125 is
+*          12.5V). The divider calibration is folded into one integer constant at compile time, and the alarm
+*          thresholds are converted into ADC counts once when they are saved, so checking the voltage alarm is a
+*          plain integer compare.
+*/
+
+#ifndef VOLT_FIXED_H
+#define VOLT_FIXED_H
+
+#include <stdint.h>
+
+/* Voltage divider at the input to A0 (in ohms) and the ADC reference (in decivolts) */
+#define VOLT_R_IN 3430ULL
+#define VOLT_R_BIG 8980ULL
+#define VOLT_VREF_DECIVOLTS 50ULL
+#define VOLT_ADC_MAX 1023
+
+/* Decivolts per ADC count in Q24 fixed point, rounded; 1023 counts times this still fits 32 bits */
+static const uint32_t VOLT_DECIVOLTS_PER_COUNT_Q24 =
+    (uint32_t)(((VOLT_VREF_DECIVOLTS * (VOLT_R_BIG + VOLT_R_IN) << 24) + VOLT_R_IN * VOLT_ADC_MAX / 2) / (VOLT_R_IN * VOLT_ADC_MAX));
+
+//+ Converts an ADC reading into decivolts, truncated like the float conversion it replaces
+inline uint16_t counts_to_decivolts(uint16_t counts)
+{
+  return ((uint32_t)counts * VOLT_DECIVOLTS_PER_COUNT_Q24) >> 24;
+}
+
+//+ The highest ADC reading that is at or below the given voltage, -1 if even 0 counts is above it
+int16_t counts_at_or_below(uint16_t decivolts);
+
+//+ The lowest ADC reading that is at or above the given voltage, VOLT_ADC_MAX + 1 if no reading reaches it
+int16_t counts_at_or_above(uint16_t decivolts);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+*Overview: Implementation of the minute by minute schedule of the time alarms.
+*/
+
+#include "alarm_table.h"
+
+uint16_t hhmm_to_minute(int hhmm)
+{
+  return (hhmm / 100) * 60 + hhmm % 100;
+}
+
+int minute_to_hhmm(uint16_t minute)
+{
+  return (minute / 60) * 100 + minute % 60;
+}
+
+AlarmTable::AlarmTable()
+{
+  clear();
+  resync();
+}
+
+void AlarmTable::clear()
+{
+  bit_clear_all(minutes, sizeof(minutes));
+  alarm_count = 0;
+}
+
+void AlarmTable::set_window(uint16_t from, uint16_t to)
+{
+  // single bits up to a byte boundary, then whole bytes, then the bits left over
+  while (from < to && (from & 7) != 0)
+  {
+    bit_set(minutes, from++, true);
+  }
+  while (from + 8 <= to)
+  {
+    minutes[from >> 3] = 0xFF;
+    from += 8;
+  }
+  while (from < to)
+  {
+    bit_set(minutes, from++, true);
+  }
+}
+
+void AlarmTable::add(uint16_t on_minute, uint16_t off_minute, bool runs_today, bool ran_yesterday)
+{
+  alarm_count++;
+
+  if (on_minute < off_minute)
+  {
+    if (runs_today)
+    {
+      set_window(on_minute, off_minute);
+    }
+    return;
+  }
+
+  // overnight, or 24 hours when the two are the same
+  if (runs_today)
+  {
+    set_window(on_minute, MINUTES_PER_DAY);
+  }
+  if (ran_yesterday)
+  {
+    set_window(0, off_minute);
+  }
+}
+
+bool AlarmTable::check(uint16_t now_minute, bool &relay_on)
+{
+  // with no alarms every minute is OFF, so deleting the last one switches the relay OFF like any other change; a
+  // change is reported whenever it is seen, so an edge that was missed is caught on the next check
+  uint8_t wanted = relay_on_at(now_minute);
+  if (wanted == reported)
+  {
+    return false;
+  }
+  reported = wanted;
+  relay_on = wanted;
+  return true;
+}
+
+bool AlarmTable::next_event(uint16_t now_minute, AlarmEvent &event) const
+{
+  bool state = relay_on_at(now_minute);
+  uint8_t unchanged = state ? 0xFF : 0x00;
+
+  uint16_t minute = now_minute + 1 == MINUTES_PER_DAY ? 0 : now_minute + 1;
+  uint16_t left = MINUTES_PER_DAY - 1;
+  while (left > 0)
+  {
+    // whole bytes without a change are skipped (the day is a whole number of bytes, so they do not wrap)
+    if ((minute & 7) == 0 && left >= 8 && minutes[minute >> 3] == unchanged)
+    {
+      minute += 8;
+      left -= 8;
+    }
+    else if (relay_on_at(minute) != state)
+    {
+      event.minute = minute;
+      event.relay_on = !state;
+      return true;
+    }
+    else
+    {
+      minute++;
+      left--;
+    }
+
+    if (minute == MINUTES_PER_DAY)
+    {
+      minute = 0;
+    }
+  }
+  return false;
+}
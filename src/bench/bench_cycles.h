@@ -0,0 +1,47 @@
+/*
+*Overview: The counter the benchmarks time their loops with: CPU cycles from hal_cycles() on the Uno, the TSC on x86
+*          hosts and nanoseconds of the monotonic clock on other hosts. BENCH_CYCLES_UNIT names what it counts for the
+*          printed results.
+*/
+
+#ifndef BENCH_CYCLES_H
+#define BENCH_CYCLES_H
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include "hal.h"
+
+#define BENCH_CYCLES_UNIT "cycles"
+
+// Timer1 only counts 32 bits, the difference of two readings is right as long as it fits
+typedef uint32_t bench_cycles_t;
+#else
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+#define BENCH_CYCLES_UNIT "cycles"
+#else
+#define BENCH_CYCLES_UNIT "ns"
+#endif
+
+typedef uint64_t bench_cycles_t;
+#endif
+
+//+ Reads the counter of the target
+static inline bench_cycles_t read_cycles()
+{
+#ifdef ARDUINO
+  return hal_cycles();
+#elif defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+#endif
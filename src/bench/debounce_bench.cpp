@@ -0,0 +1,108 @@
+/*
+*Overview: Host benchmark of the button debouncing, six Bounce2 style debouncers (what loop() used to update on every
+*          pass) against one VerticalDebounce sample of all the pins (what the timer interrupt now does). Both are fed
+*          the same bouncing button presses and have to report the same number of presses.
+*          Run with `pio run -e bench_debounce` and execute .pio/build/bench_debounce/program.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_cycles.h"
+#include "vertical_debounce.h"
+
+static const uint8_t BUTTONS = 6;
+static const uint16_t INTERVAL_MS = 50;
+
+/* One simulated millisecond per step */
+static const uint32_t STEPS = 2000000;
+
+/* The raw levels of the buttons over time, with contact bounce at every press and release */
+static uint8_t raw_levels[STEPS / 64 + 1];
+
+static volatile uint32_t sink = 0;
+
+//+ The stable interval debouncing of the Bounce2 library, one per button
+struct BounceLike
+{
+  uint8_t stable_state;
+  uint8_t unstable_state;
+  bool changed;
+  uint32_t previous_millis;
+
+  bool update(uint8_t reading, uint32_t now)
+  {
+    changed = false;
+    if (reading != unstable_state)
+    {
+      previous_millis = now;
+      unstable_state = reading;
+    }
+    else if (now - previous_millis >= INTERVAL_MS && reading != stable_state)
+    {
+      stable_state = reading;
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool rose() const { return changed && stable_state; }
+};
+
+//+ The levels at step, the raw levels only change every 64ms so a table of them stays small
+static uint8_t levels_at(uint32_t step)
+{
+  uint8_t levels = raw_levels[step / 64];
+  // bouncing for the first 5ms after a change: on the odd milliseconds the pins read their previous levels
+  if (step % 64 < 5 && (step & 1))
+  {
+    levels ^= raw_levels[step / 64] ^ raw_levels[step / 64 == 0 ? 0 : step / 64 - 1];
+  }
+  return levels;
+}
+
+int main()
+{
+  srand(1);
+  for (uint32_t i = 0; i < sizeof(raw_levels); i++)
+  {
+    raw_levels[i] = rand() & ((1 << BUTTONS) - 1);
+  }
+
+  // Bounce2: every button is updated on every pass of loop(), taken here as once per millisecond
+  BounceLike bounces[BUTTONS] = {};
+  uint32_t bounce_presses = 0;
+  uint64_t start = read_cycles();
+  for (uint32_t step = 0; step < STEPS; step++)
+  {
+    uint8_t levels = levels_at(step);
+    for (uint8_t b = 0; b < BUTTONS; b++)
+    {
+      bounces[b].update((levels >> b) & 1, step);
+      bounce_presses += bounces[b].rose();
+    }
+  }
+  double bounce_cycles = (double)(read_cycles() - start) / STEPS;
+
+  // vertical counters: all the buttons in one sample, taken every 6ms to give the same 50ms of debouncing
+  VerticalDebounce debounce;
+  uint32_t vertical_presses = 0;
+  start = read_cycles();
+  for (uint32_t step = 0; step < STEPS; step += 6)
+  {
+    uint8_t changed = debounce.sample(levels_at(step));
+    vertical_presses += __builtin_popcount(changed & debounce.levels());
+  }
+  double vertical_cycles = (double)(read_cycles() - start) / (STEPS / 6);
+  sink += bounce_presses + vertical_presses;
+
+  const char *unit = BENCH_CYCLES_UNIT;
+
+  printf("bounce2 x%u: %.2f %s per pass (%u presses)\n", BUTTONS, bounce_cycles, unit, bounce_presses);
+  printf("vertical counter: %.2f %s per sample (%u presses)\n", vertical_cycles, unit, vertical_presses);
+  printf("per second: bounce2 %.0f %s at 1000 passes, vertical counter %.0f %s\n", bounce_cycles * 1000, unit,
+         vertical_cycles * 1000 / 6, unit);
+
+  return bounce_presses == vertical_presses ? 0 : 1;
+}
@@ -0,0 +1,296 @@
+/*
+*Overview: Benchmark of the firmware's hot kernels, built with the real main.cpp on both the host ([env:bench_kernels])
+*          and the Uno ([env:uno_bench_kernels]). Each kernel is called a number of times after setup(), every call is
+*          timed on its own and the stack it used is measured by painting the free stack before the call. The results
+*          are printed as one JSON object per line, so they can be collected and compared across releases:
+*
+*          {"bench":"kernels","target":"avr","unit":"cycles","kernel":"lcd_flush","calls":100,"min":..,"mean":..,
+*           "max":..,"stack_bytes":..}
+*
+*          On the Uno the counts are CPU cycles from Timer1 and the output goes to the serial port at the firmware's
+*          baud rate (lines that do not start with { are the firmware's own). Interrupts stay on, so min is the clean
+*          figure while mean and max include the timer, ADC and I2C interrupts that hit a call. On the host the
+*          counts are TSC cycles (nanoseconds where there is no TSC). The time it takes to read the counter is taken
+*          off every call, and the "empty" kernel shows what is left of the harness in the figures (its stack is the
+*          floor of every other one).
+*          Run with `pio run -e bench_kernels` and execute .pio/build/bench_kernels/program, or upload
+*          [env:uno_bench_kernels] and read the serial port.
+*/
+
+#include <stdint.h>
+
+#include "alarm_table.h"
+#include "bench_cycles.h"
+#include "button_input.h"
+#include "hal.h"
+#include "lcd_buffer.h"
+#include "volt_fixed.h"
+
+#ifdef ARDUINO
+static const char TARGET[] = "avr";
+static const uint16_t CALLS = 100;
+#else
+#include "hal_host.h"
+
+static const char TARGET[] = "host";
+static const uint16_t CALLS = 10000;
+#endif
+
+static const char UNIT[] = BENCH_CYCLES_UNIT;
+
+/* Calls of each kernel made with a freshly painted stack */
+static const uint8_t STACK_CALLS = 8;
+
+/* The firmware, defined in main.cpp */
+void setup();
+void handle_time_alarms();
+int measure_voltage();
+void handle_volt_alarm(int counts_measured);
+int handle_time_entry(int cursorPos, int *ptime);
+int handle_volt_entry(int cursorPos, int *pvolt);
+int handle_new_date_time_entry(int cursorPos, int *pnewdatetime);
+void draw_idle_screen();
+
+extern HalDisplay display;
+extern LcdBuffer lcd;
+extern ButtonInput buttons;
+extern AlarmTable alarm_table;
+extern int16_t ON_volt_counts;
+extern int16_t OFF_volt_counts;
+
+/* The button pins of main.cpp */
+static const uint8_t UP_PIN = 3;
+static const uint8_t DOWN_PIN = 2;
+static const uint8_t LEFT_PIN = 4;
+static const uint8_t RIGHT_PIN = 5;
+
+static HalSerial serial;
+
+/* Results are accumulated here so the compiler can not drop the calls */
+static volatile uint32_t sink = 0;
+
+/* The time it takes to read the counter, measured before the first kernel */
+static uint32_t read_overhead = 0;
+
+typedef void (*BenchStep)(uint16_t call);
+
+//+ Times calls of run, each after an untimed prepare, and prints the line of results
+static void bench(const __FlashStringHelper *kernel, BenchStep prepare, BenchStep run)
+{
+  uint32_t min = 0xFFFFFFFF;
+  uint32_t max = 0;
+  uint32_t total = 0;
+
+  for (uint16_t call = 0; call < CALLS; call++)
+  {
+    prepare(call);
+    // the display bus is left idle, so a call does not pay for the writes of the one before
+    while (display.bus_stats().depth != 0)
+    {
+    }
+
+    uint32_t start = read_cycles();
+    run(call);
+    uint32_t cycles = read_cycles() - start;
+
+    cycles = cycles > read_overhead ? cycles - read_overhead : 0;
+    total += cycles;
+    min = cycles < min ? cycles : min;
+    max = cycles > max ? cycles : max;
+  }
+
+  uint16_t stack = 0;
+  for (uint8_t call = 0; call < STACK_CALLS; call++)
+  {
+    prepare(call);
+    while (display.bus_stats().depth != 0)
+    {
+    }
+
+    hal_stack_paint();
+    run(call);
+    uint16_t used = hal_stack_used();
+    stack = used > stack ? used : stack;
+  }
+
+  serial.print(F("{\"bench\":\"kernels\",\"target\":\""));
+  serial.print(TARGET);
+  serial.print(F("\",\"unit\":\""));
+  serial.print(UNIT);
+  serial.print(F("\",\"kernel\":\""));
+  serial.print(kernel);
+  serial.print(F("\",\"calls\":"));
+  serial.print((long)CALLS);
+  serial.print(F(",\"min\":"));
+  serial.print((long)min);
+  serial.print(F(",\"mean\":"));
+  serial.print((long)(total / CALLS));
+  serial.print(F(",\"max\":"));
+  serial.print((long)max);
+  serial.print(F(",\"stack_bytes\":"));
+  serial.print((long)stack);
+  serial.println(F("}"));
+}
+
+//+ Makes the next pass see a press of the button on pin, as the menus do after ButtonInput::update()
+static void press(uint8_t pin)
+{
+  unsigned long now = hal_millis();
+
+  // the release of the previous press is taken first
+  buttons.sample(0, now);
+  buttons.update(now);
+  buttons.sample(1 << pin, now);
+  buttons.update(now);
+}
+
+/* The presses fed to the entry handlers, a walk over the digits that changes some of them */
+static const uint8_t ENTRY_PRESSES[] = {UP_PIN, RIGHT_PIN, UP_PIN, UP_PIN, RIGHT_PIN, DOWN_PIN, RIGHT_PIN, UP_PIN,
+                                        LEFT_PIN, DOWN_PIN, LEFT_PIN, LEFT_PIN};
+static const uint8_t ENTRY_PRESS_COUNT = sizeof(ENTRY_PRESSES) / sizeof(ENTRY_PRESSES[0]);
+
+/* The digits and cursors of the entry handlers, as the menus keep them */
+static int time_digits[4];
+static int time_cursor = 0;
+static int volt_digits[4];
+static int volt_cursor = 0;
+static int datetime_digits[16];
+static int datetime_cursor = 0;
+
+/* The kernels */
+static void no_prepare(uint16_t call) { (void)call; }
+static void press_entry_button(uint16_t call) { press(ENTRY_PRESSES[call % ENTRY_PRESS_COUNT]); }
+
+static void run_empty(uint16_t call) { (void)call; }
+static void run_time_alarms(uint16_t call)
+{
+  (void)call;
+  handle_time_alarms();
+}
+static void run_alarm_table_check(uint16_t call)
+{
+  bool relay_on;
+  sink += alarm_table.check(call % MINUTES_PER_DAY, relay_on);
+}
+static void run_alarm_table_next_event(uint16_t call)
+{
+  AlarmEvent event;
+  sink += alarm_table.next_event(call % MINUTES_PER_DAY, event);
+}
+static void run_measure_voltage(uint16_t call)
+{
+  (void)call;
+  sink += measure_voltage();
+}
+static void run_counts_to_decivolts(uint16_t call) { sink += counts_to_decivolts(call & VOLT_ADC_MAX); }
+static void run_volt_alarm(uint16_t call)
+{
+  // a triangle over the whole range, so the relay is switched both ways
+  uint16_t step = (call * 37) % (2 * (VOLT_ADC_MAX + 1));
+  handle_volt_alarm(step <= VOLT_ADC_MAX ? step : 2 * (VOLT_ADC_MAX + 1) - 1 - step);
+}
+static void run_time_entry(uint16_t call)
+{
+  (void)call;
+  time_cursor = handle_time_entry(time_cursor, time_digits);
+}
+static void run_volt_entry(uint16_t call)
+{
+  (void)call;
+  volt_cursor = handle_volt_entry(volt_cursor, volt_digits);
+}
+static void run_datetime_entry(uint16_t call)
+{
+  (void)call;
+  datetime_cursor = handle_new_date_time_entry(datetime_cursor, datetime_digits);
+}
+static void run_draw_idle_screen(uint16_t call)
+{
+  (void)call;
+  draw_idle_screen();
+}
+static void redraw_or_clear(uint16_t call)
+{
+  // every flush has a whole screen of changes to send
+  if (call % 2 == 0)
+  {
+    draw_idle_screen();
+  }
+  else
+  {
+    lcd.clear();
+  }
+}
+static void run_lcd_flush(uint16_t call)
+{
+  (void)call;
+  sink += lcd.flush();
+}
+
+//+ Runs the firmware's setup() and every kernel once, then idles
+static void run_benchmarks()
+{
+#ifdef ARDUINO
+  hal_cycles_begin();
+#endif
+
+  // the cost of reading the counter, the least of a few tries
+  read_overhead = 0xFFFFFFFF;
+  for (uint8_t i = 0; i < 16; i++)
+  {
+    uint32_t start = read_cycles();
+    uint32_t cycles = read_cycles() - start;
+    read_overhead = cycles < read_overhead ? cycles : read_overhead;
+  }
+
+  // an hour ON and an hour OFF over the whole day, and voltage thresholds that the sweep of handle_volt_alarm crosses
+  alarm_table.clear();
+  for (uint16_t minute = 0; minute < MINUTES_PER_DAY; minute += 120)
+  {
+    alarm_table.add(minute, minute + 60, true, true);
+  }
+  ON_volt_counts = counts_at_or_below(118);
+  OFF_volt_counts = counts_at_or_above(134);
+
+  bench(F("empty"), no_prepare, run_empty);
+  bench(F("handle_time_alarms"), no_prepare, run_time_alarms);
+  bench(F("alarm_table_check"), no_prepare, run_alarm_table_check);
+  bench(F("alarm_table_next_event"), no_prepare, run_alarm_table_next_event);
+  bench(F("measure_voltage"), no_prepare, run_measure_voltage);
+  bench(F("counts_to_decivolts"), no_prepare, run_counts_to_decivolts);
+  bench(F("handle_volt_alarm"), no_prepare, run_volt_alarm);
+  bench(F("handle_time_entry"), press_entry_button, run_time_entry);
+  bench(F("handle_volt_entry"), press_entry_button, run_volt_entry);
+  bench(F("handle_new_date_time_entry"), press_entry_button, run_datetime_entry);
+  bench(F("draw_idle_screen"), no_prepare, run_draw_idle_screen);
+  bench(F("lcd_flush"), redraw_or_clear, run_lcd_flush);
+}
+
+#ifdef ARDUINO
+// Replaces the main() of the Arduino core (which is only linked from the core library when nothing else defines it)
+int main()
+{
+  init();
+  setup();
+  run_benchmarks();
+  serial.flush();
+  while (true)
+  {
+  }
+}
+#else
+int main()
+{
+  // what setup() prints is not part of the results
+  host_capture_serial(true);
+  setup();
+  char line[128];
+  while (host_serial_line(line, sizeof(line)))
+  {
+  }
+  host_capture_serial(false);
+
+  run_benchmarks();
+  return 0;
+}
+#endif
@@ -0,0 +1,123 @@
+/*
+*Overview: Host benchmark of the voltage conversion, the float divider math measure_voltage() used to do against the
+*          fixed point conversion in volt_fixed.h, plus the raw count compare that handle_volt_alarm() now does.
+*          Run with `pio run -e bench` and execute .pio/build/bench/program.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bench_cycles.h"
+#include "volt_fixed.h"
+
+/* Every ADC reading is converted this many times per measurement */
+static const uint16_t ROUNDS = 2000;
+
+/* Results are accumulated here so the compiler can not drop the loops */
+static volatile uint32_t sink = 0;
+
+//+ The conversion measure_voltage() did before, in decivolts
+static int float_decivolts(uint16_t counts)
+{
+  float R_in = 3430;
+  float R_big = 8980;
+  float v_in = counts * 5.0 / 1023.0;
+  float v_real = v_in * (R_big + R_in) / R_in;
+  return v_real * 10;
+}
+
+static double bench_float()
+{
+  uint64_t start = read_cycles();
+  for (uint16_t round = 0; round < ROUNDS; round++)
+  {
+    uint32_t total = 0;
+    for (uint16_t counts = 0; counts <= VOLT_ADC_MAX; counts++)
+    {
+      total += float_decivolts((counts + round) & VOLT_ADC_MAX);
+    }
+    sink += total;
+  }
+  return (double)(read_cycles() - start) / ((uint32_t)ROUNDS * (VOLT_ADC_MAX + 1));
+}
+
+static double bench_fixed()
+{
+  uint64_t start = read_cycles();
+  for (uint16_t round = 0; round < ROUNDS; round++)
+  {
+    uint32_t total = 0;
+    for (uint16_t counts = 0; counts <= VOLT_ADC_MAX; counts++)
+    {
+      total += counts_to_decivolts((counts + round) & VOLT_ADC_MAX);
+    }
+    sink += total;
+  }
+  return (double)(read_cycles() - start) / ((uint32_t)ROUNDS * (VOLT_ADC_MAX + 1));
+}
+
+//+ The alarm check as it was (float conversion then a decivolt compare) against the raw count compare
+static double bench_alarm(bool fixed, int16_t on_counts, int on_decivolts)
+{
+  uint64_t start = read_cycles();
+  for (uint16_t round = 0; round < ROUNDS; round++)
+  {
+    uint32_t total = 0;
+    for (uint16_t counts = 0; counts <= VOLT_ADC_MAX; counts++)
+    {
+      uint16_t reading = (counts + round) & VOLT_ADC_MAX;
+      if (fixed)
+      {
+        total += (int16_t)reading <= on_counts;
+      }
+      else
+      {
+        total += float_decivolts(reading) <= on_decivolts;
+      }
+    }
+    sink += total;
+  }
+  return (double)(read_cycles() - start) / ((uint32_t)ROUNDS * (VOLT_ADC_MAX + 1));
+}
+
+int main()
+{
+  // the fixed point conversion has to give the same decivolts as the float one for every reading
+  uint16_t mismatches = 0;
+  for (uint16_t counts = 0; counts <= VOLT_ADC_MAX; counts++)
+  {
+    if (float_decivolts(counts) != counts_to_decivolts(counts))
+    {
+      printf("mismatch at %u counts: float %d, fixed %u\n", counts, float_decivolts(counts), counts_to_decivolts(counts));
+      mismatches++;
+    }
+  }
+
+  // and the thresholds in counts have to switch at the same readings as the decivolt compare
+  for (uint16_t threshold = 0; threshold <= 200; threshold++)
+  {
+    int16_t on_counts = counts_at_or_below(threshold);
+    int16_t off_counts = counts_at_or_above(threshold);
+    for (uint16_t counts = 0; counts <= VOLT_ADC_MAX; counts++)
+    {
+      int decivolts = float_decivolts(counts);
+      if (((int16_t)counts <= on_counts) != (decivolts <= threshold) ||
+          ((int16_t)counts >= off_counts) != (decivolts >= threshold))
+      {
+        printf("threshold %u.%uV switches at the wrong reading (%u counts)\n", threshold / 10, threshold % 10, counts);
+        mismatches++;
+        break;
+      }
+    }
+  }
+
+  const char *unit = BENCH_CYCLES_UNIT;
+
+  printf("conversion, float: %.2f %s per reading\n", bench_float(), unit);
+  printf("conversion, fixed: %.2f %s per reading\n", bench_fixed(), unit);
+  printf("alarm check, float: %.2f %s per reading\n", bench_alarm(false, 0, 125), unit);
+  printf("alarm check, counts: %.2f %s per reading\n", bench_alarm(true, counts_at_or_below(125), 125), unit);
+  printf("%u mismatches\n", mismatches);
+
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+/*
+*Overview: Implementation of the button events.
+*/
+
+#include "button_input.h"
+
+ButtonInput::ButtonInput()
+{
+  begin(0, 0, 0);
+}
+
+void ButtonInput::begin(uint8_t pin_mask, uint8_t levels, unsigned long now_ms)
+{
+  mask = pin_mask;
+  stable = levels & pin_mask;
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    changed_ms[i] = now_ms;
+  }
+
+  head = 0;
+  tail = 0;
+  dropped = 0;
+  has_current = false;
+  now = now_ms;
+  activity_ms = now_ms;
+}
+
+void ButtonInput::sample(uint8_t levels, unsigned long time_ms)
+{
+  uint8_t changed = (levels & mask) ^ stable;
+  stable ^= changed;
+  for (uint8_t i = 0; changed != 0; i++, changed >>= 1)
+  {
+    if (changed & 1)
+    {
+      changed_ms[i] = time_ms;
+      push(i, (stable >> i) & 1, time_ms);
+    }
+  }
+}
+
+void ButtonInput::update(unsigned long now_ms)
+{
+  now = now_ms;
+
+  has_current = head != tail;
+  if (has_current)
+  {
+    current = queue[tail];
+    tail = (tail + 1) & (QUEUE_SIZE - 1);
+  }
+}
+
+void ButtonInput::push(uint8_t pin, bool pressed, unsigned long time_ms)
+{
+  activity_ms = time_ms;
+
+  uint8_t next = (head + 1) & (QUEUE_SIZE - 1);
+  if (next == tail)
+  {
+    dropped++;
+    return;
+  }
+  queue[head].pin = pin;
+  queue[head].pressed = pressed;
+  queue[head].time_ms = time_ms;
+  head = next;
+}
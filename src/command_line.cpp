@@ -0,0 +1,82 @@
+/*
+*Overview: Implementation of the serial console line assembler.
+*/
+
+#include "command_line.h"
+
+CommandLine::CommandLine()
+{
+  buffer[0] = '\0';
+  length = 0;
+  overflow = false;
+  last_was_cr = false;
+  finished = false;
+  word_count = 0;
+}
+
+void CommandLine::split()
+{
+  word_count = 0;
+
+  uint8_t i = 0;
+  while (i < length)
+  {
+    // words are separated by any run of spaces or tabs, which become terminators
+    while (i < length && (buffer[i] == ' ' || buffer[i] == '\t'))
+    {
+      buffer[i++] = '\0';
+    }
+    if (i == length)
+    {
+      break;
+    }
+    if (word_count == MAX_WORDS)
+    {
+      overflow = true;
+      break;
+    }
+    starts[word_count++] = i;
+    while (i < length && buffer[i] != ' ' && buffer[i] != '\t')
+    {
+      i++;
+    }
+  }
+}
+
+bool CommandLine::feed(char c)
+{
+  // a CR LF pair ends one line, not two
+  bool cr_lf = last_was_cr && c == '\n';
+  last_was_cr = c == '\r';
+  if (cr_lf)
+  {
+    return false;
+  }
+
+  // the previous line has been handled once more characters come in
+  if (finished)
+  {
+    length = 0;
+    overflow = false;
+    word_count = 0;
+    finished = false;
+  }
+
+  if (c == '\r' || c == '\n')
+  {
+    buffer[length] = '\0';
+    split();
+    finished = true;
+    return true;
+  }
+
+  if (length + 1 < SIZE)
+  {
+    buffer[length++] = c;
+  }
+  else
+  {
+    overflow = true;
+  }
+  return false;
+}
@@ -0,0 +1,246 @@
+/*
+*Overview: Implementation of the EEPROM record log.
+*/
+
+#include "ee_journal.h"
+
+/* Offsets the key byte of a record, so blank (0x00 or 0xFF) or foreign EEPROM contents are not taken for records.
+Up to 16 keys this is the 0xA0 | key the log has always been written with */
+#define KEY_MARK 0xA0
+
+static_assert(KEY_MARK + EeJournal::MAX_KEYS - 1 < 0xFF, "the key byte of the last key would read as blank EEPROM");
+
+//+ CRC-8 (polynomial 0x31) starting from 0xFF, so neither an all 0x00 nor an all 0xFF record checks out
+static uint8_t crc8(const uint8_t *data, uint8_t length)
+{
+  uint8_t crc = 0xFF;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+//+ Sequence numbers wrap around, every record on the EEPROM is within a few hundred of the newest one
+static bool seq_newer(uint16_t seq, uint16_t than)
+{
+  return (int16_t)(seq - than) > 0;
+}
+
+EeJournal::EeJournal(HalStorage &storage, int start, int size)
+    : storage(storage), start(start), slots_per_bank(bank_slots(size))
+{
+  for (uint8_t key = 0; key < MAX_KEYS; key++)
+  {
+    latest[key] = -1;
+  }
+  bank = 0;
+  head = 0;
+  next_seq = 0;
+  records_written = 0;
+  passes[0] = 0;
+  passes[1] = 0;
+}
+
+uint8_t EeJournal::begin()
+{
+  uint8_t slot_count = slots();
+  uint16_t latest_seq[MAX_KEYS];
+  int16_t newest_slot = -1;
+  uint16_t newest_seq = 0;
+
+  for (uint8_t key = 0; key < MAX_KEYS; key++)
+  {
+    latest[key] = -1;
+  }
+  storage.get(start + slot_count * RECORD_SIZE, passes);
+
+  for (uint8_t slot = 0; slot < slot_count; slot++)
+  {
+    uint16_t seq;
+    uint8_t key;
+    uint8_t data[JOURNAL_DATA_SIZE];
+    if (!read_record(slot, seq, key, data))
+    {
+      continue;
+    }
+    if (latest[key] < 0 || seq_newer(seq, latest_seq[key]))
+    {
+      latest[key] = slot;
+      latest_seq[key] = seq;
+    }
+    if (newest_slot < 0 || seq_newer(seq, newest_seq))
+    {
+      newest_slot = slot;
+      newest_seq = seq;
+    }
+  }
+
+  if (newest_slot < 0)
+  {
+    // an empty log, the counters are only trusted alongside records
+    bank = 0;
+    head = 0;
+    next_seq = 0;
+    passes[0] = 0;
+    passes[1] = 0;
+    start_pass(0);
+    return 0;
+  }
+
+  bank = bank_of(newest_slot);
+  head = newest_slot + 1;
+  next_seq = newest_seq + 1;
+
+  // A compaction cut short by a power loss leaves some keys only in the old bank, they are moved over now before
+  // the next compaction can overwrite them
+  uint8_t found = 0;
+  for (uint8_t key = 0; key < MAX_KEYS; key++)
+  {
+    if (latest[key] < 0)
+    {
+      continue;
+    }
+    found++;
+    if (bank_of(latest[key]) != bank_of(newest_slot))
+    {
+      uint8_t data[JOURNAL_DATA_SIZE];
+      read(key, data);
+      append(key, data);
+    }
+  }
+  return found;
+}
+
+bool EeJournal::read(uint8_t key, uint8_t *data)
+{
+  if (key >= MAX_KEYS || latest[key] < 0)
+  {
+    return false;
+  }
+
+  int address = start + latest[key] * RECORD_SIZE + 3;
+  for (uint8_t i = 0; i < JOURNAL_DATA_SIZE; i++)
+  {
+    data[i] = storage.read(address + i);
+  }
+  return true;
+}
+
+void EeJournal::write(uint8_t key, const uint8_t *data)
+{
+  if (key >= MAX_KEYS)
+  {
+    return;
+  }
+
+  uint8_t stored[JOURNAL_DATA_SIZE];
+  if (read(key, stored))
+  {
+    bool same = true;
+    for (uint8_t i = 0; i < JOURNAL_DATA_SIZE; i++)
+    {
+      same = same && stored[i] == data[i];
+    }
+    if (same)
+    {
+      return;
+    }
+  }
+
+  append(key, data);
+}
+
+void EeJournal::append(uint8_t key, const uint8_t *data)
+{
+  if (head == (bank + 1) * slots_per_bank)
+  {
+    compact();
+  }
+
+  write_record(head, key, data);
+  latest[key] = head;
+  head++;
+}
+
+void EeJournal::compact()
+{
+  // every newest record is in the full bank, so nothing still needed lives in the bank being overwritten
+  bank ^= 1;
+  head = bank * slots_per_bank;
+  start_pass(bank);
+
+  for (uint8_t key = 0; key < MAX_KEYS; key++)
+  {
+    if (latest[key] >= 0)
+    {
+      uint8_t data[JOURNAL_DATA_SIZE];
+      read(key, data);
+      write_record(head, key, data);
+      latest[key] = head;
+      head++;
+    }
+  }
+}
+
+uint32_t EeJournal::slot_writes(uint8_t slot) const
+{
+  uint8_t which = bank_of(slot);
+  // the slots of the bank being written that the current pass has not reached yet
+  if (which == bank && slot >= head && passes[which] > 0)
+  {
+    return passes[which] - 1;
+  }
+  return passes[which];
+}
+
+//+ Counts a new pass through a bank in the reserved area
+void EeJournal::start_pass(uint8_t which)
+{
+  passes[which]++;
+  storage.put(start + slots() * RECORD_SIZE + which * sizeof(uint32_t), passes[which]);
+}
+
+bool EeJournal::read_record(uint8_t slot, uint16_t &seq, uint8_t &key, uint8_t *data)
+{
+  uint8_t record[RECORD_SIZE];
+  storage.get(start + slot * RECORD_SIZE, record);
+
+  // keys beyond MAX_KEYS (from a build with more alarms) are left out, and dropped at the next compaction
+  if (crc8(record, RECORD_SIZE - 1) != record[RECORD_SIZE - 1] || record[2] < KEY_MARK ||
+      record[2] >= KEY_MARK + MAX_KEYS)
+  {
+    return false;
+  }
+
+  seq = record[0] | (record[1] << 8);
+  key = record[2] - KEY_MARK;
+  for (uint8_t i = 0; i < JOURNAL_DATA_SIZE; i++)
+  {
+    data[i] = record[3 + i];
+  }
+  return true;
+}
+
+void EeJournal::write_record(uint8_t slot, uint8_t key, const uint8_t *data)
+{
+  uint8_t record[RECORD_SIZE];
+  record[0] = next_seq & 0xFF;
+  record[1] = next_seq >> 8;
+  record[2] = KEY_MARK + key;
+  for (uint8_t i = 0; i < JOURNAL_DATA_SIZE; i++)
+  {
+    record[3 + i] = data[i];
+  }
+  record[RECORD_SIZE - 1] = crc8(record, RECORD_SIZE - 1);
+
+  // the CRC goes last, a record cut short by a power loss is very unlikely to check out
+  storage.put(start + slot * RECORD_SIZE, record);
+
+  next_seq++;
+  records_written++;
+}
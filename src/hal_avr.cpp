@@ -0,0 +1,609 @@
+/*
+*Overview: Arduino Uno implementation of the hardware abstraction layer. It wraps the EEPROM library, debounces the
+*          buttons from a timer interrupt, and drives the LCD backpack and the DS1307 directly through the
+*          interrupt driven I2C queue in i2c_async.h so that display updates do not block loop(). Between the RTC
+*          ticks the MCU can be put in power down, woken by the DS1307 square wave or a button.
+*/
+
+#include <EEPROM.h>
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#include "hal.h"
+#include "eeprom_queue.h"
+#include "i2c_async.h"
+#include "sample_ring.h"
+#include "vertical_debounce.h"
+
+/* Both the PCF8574 and the DS1307 are limited to 100kHz */
+static const uint32_t I2C_CLOCK_HZ = 100000;
+
+/* Setting the address of the LCD diplay as 0x27 */
+static const uint8_t LCD_ADDRESS = 0x27;
+
+/* PCF8574 pins of the backpack (same wiring as LiquidCrystal_I2C(0x27, 2, 1, 0, 4, 5, 6, 7, 3, POSITIVE)) */
+static const uint8_t LCD_RS = 0x01;
+static const uint8_t LCD_EN = 0x04;
+static const uint8_t LCD_BACKLIGHT = 0x08;
+
+/* HD44780 instructions */
+static const uint8_t LCD_CLEAR = 0x01;
+static const uint8_t LCD_ENTRY_LEFT = 0x06;
+static const uint8_t LCD_DISPLAY_ON = 0x0C;
+static const uint8_t LCD_CURSOR_ON = 0x02;
+static const uint8_t LCD_FUNCTION_4BIT_2LINE = 0x28;
+static const uint8_t LCD_SET_DDRAM = 0x80;
+
+/* A character or instruction is 4 bytes on the bus, plus 2 bytes of queue header */
+static const uint8_t LCD_WRITE_QUEUE_BYTES = 6;
+
+/* Address of the DS1307 RTC and its clock halt bit */
+static const uint8_t RTC_ADDRESS = 0x68;
+static const uint8_t RTC_CLOCK_HALT = 0x80;
+
+/* DS1307 control register, SQWE with RS1:0 clear gives a 1Hz square wave */
+static const uint8_t RTC_CONTROL = 0x07;
+static const uint8_t RTC_SQW_1HZ = 0x10;
+
+/* Latest samples of the analog pin, filled by the ADC interrupt */
+static SampleRing adc_ring;
+
+/* TIMING */
+unsigned long hal_millis() { return millis(); }
+unsigned long hal_micros() { return micros(); }
+void hal_delay(unsigned long ms) { delay(ms); }
+void hal_delay_us(unsigned int us) { delayMicroseconds(us); }
+
+#ifdef HAL_CYCLES
+// The upper 16 bits of the cycle count
+static volatile uint16_t cycle_overflows = 0;
+
+void hal_cycles_begin()
+{
+  // normal mode without a prescaler, the overflow interrupt extends the count to 32 bits
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1);
+  TIMSK1 = _BV(TOIE1);
+}
+
+uint32_t hal_cycles()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t low = TCNT1;
+  uint16_t high = cycle_overflows;
+
+  // an overflow that has not been handled yet, the low count already wrapped
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000)
+  {
+    high++;
+  }
+  SREG = sreg;
+
+  return ((uint32_t)high << 16) | low;
+}
+
+ISR(TIMER1_OVF_vect) { cycle_overflows++; }
+#endif
+
+#ifdef KERNEL_BENCH
+/* The free RAM between the heap and the stack, as laid out by avr-libc */
+extern char __heap_start;
+extern char *__brkval;
+
+static const uint8_t STACK_PAINT = 0xA5;
+static uint8_t *stack_painted_top;
+
+static uint8_t *stack_free_start() { return (uint8_t *)(__brkval != 0 ? __brkval : &__heap_start); }
+
+void hal_stack_paint()
+{
+  // with the interrupts off nothing else writes below the stack pointer
+  uint8_t sreg = SREG;
+  cli();
+  stack_painted_top = (uint8_t *)SP;
+  for (uint8_t *p = stack_free_start(); p <= stack_painted_top; p++)
+  {
+    *p = STACK_PAINT;
+  }
+  SREG = sreg;
+}
+
+uint16_t hal_stack_used()
+{
+  // the stack grows down, so the lowest byte that lost its paint is as deep as it went
+  uint8_t *p = stack_free_start();
+  while (p <= stack_painted_top && *p == STACK_PAINT)
+  {
+    p++;
+  }
+  return stack_painted_top + 1 - p;
+}
+#endif
+
+/* GPIO AND ADC */
+void hal_gpio_mode(uint8_t pin, uint8_t mode) { pinMode(pin, mode); }
+void hal_gpio_write(uint8_t pin, uint8_t level) { digitalWrite(pin, level); }
+uint8_t hal_gpio_read(uint8_t pin) { return digitalRead(pin); }
+void hal_gpio_pwm(uint8_t pin, uint8_t duty) { analogWrite(pin, duty); }
+void hal_adc_start(uint8_t pin)
+{
+  uint8_t channel = pin >= A0 ? pin - A0 : pin;
+
+  // AVcc reference (as analogRead() uses) and the digital input buffer of the pin switched off
+  ADMUX = _BV(REFS0) | (channel & 0x07);
+  DIDR0 |= _BV(channel & 0x07);
+
+  // a conversion is started on every Timer0 overflow (~976Hz), the flag is cleared by the millis() interrupt;
+  // prescaler of 128 as the Arduino core uses
+  ADCSRB = _BV(ADTS2);
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+uint16_t hal_adc_average()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t average = adc_ring.average();
+  SREG = sreg;
+  return average;
+}
+
+ISR(ADC_vect)
+{
+  adc_ring.add(ADC);
+}
+
+/* DISPLAY */
+//+ Queues one byte for the LCD as two 4-bit halves, each latched by pulsing EN
+static void lcd_send(uint8_t value, uint8_t mode)
+{
+  uint8_t high = (value & 0xF0) | mode | LCD_BACKLIGHT;
+  uint8_t low = (uint8_t)(value << 4) | mode | LCD_BACKLIGHT;
+  uint8_t bytes[4] = {(uint8_t)(high | LCD_EN), high, (uint8_t)(low | LCD_EN), low};
+
+  i2c_async_write(LCD_ADDRESS, bytes, sizeof(bytes));
+}
+
+//+ Sends only the upper 4 bits, used while the LCD is still in 8-bit mode during start up
+static void lcd_send_nibble(uint8_t value)
+{
+  uint8_t bytes[2] = {(uint8_t)((value & 0xF0) | LCD_EN | LCD_BACKLIGHT), (uint8_t)((value & 0xF0) | LCD_BACKLIGHT)};
+
+  i2c_async_write(LCD_ADDRESS, bytes, sizeof(bytes));
+  i2c_async_flush();
+}
+
+void HalDisplay::begin(uint8_t cols, uint8_t rows)
+{
+  (void)cols;
+  (void)rows;
+
+  i2c_async_begin(I2C_CLOCK_HZ);
+
+  // the HD44780 power on reset sequence for 4-bit mode
+  hal_delay(50);
+  lcd_send_nibble(0x30);
+  hal_delay(5);
+  lcd_send_nibble(0x30);
+  hal_delay(1);
+  lcd_send_nibble(0x30);
+  lcd_send_nibble(0x20);
+
+  lcd_send(LCD_FUNCTION_4BIT_2LINE, 0);
+  lcd_send(LCD_DISPLAY_ON, 0);
+  clear();
+  lcd_send(LCD_ENTRY_LEFT, 0);
+  i2c_async_flush();
+}
+
+void HalDisplay::clear()
+{
+  // the only slow instruction, so it waits here instead of holding up the queue
+  lcd_send(LCD_CLEAR, 0);
+  i2c_async_flush();
+  hal_delay(2);
+}
+
+void HalDisplay::setCursor(uint8_t col, uint8_t row)
+{
+  static const uint8_t row_offsets[2] = {0x00, 0x40};
+  lcd_send(LCD_SET_DDRAM | (col + row_offsets[row & 0x01]), 0);
+}
+
+void HalDisplay::cursor() { lcd_send(LCD_DISPLAY_ON | LCD_CURSOR_ON, 0); }
+void HalDisplay::noCursor() { lcd_send(LCD_DISPLAY_ON, 0); }
+void HalDisplay::write(char c) { lcd_send(c, LCD_RS); }
+
+bool HalDisplay::ready() { return i2c_async_room() >= 2 * LCD_WRITE_QUEUE_BYTES; }
+
+HalBusStats HalDisplay::bus_stats()
+{
+  I2cQueueStats queue = i2c_async_stats();
+  HalBusStats stats;
+  stats.depth = queue.depth;
+  stats.peak = queue.peak;
+  stats.capacity = I2C_QUEUE_SIZE;
+  stats.overflows = queue.overflows;
+  stats.errors = queue.errors;
+  return stats;
+}
+
+/* CLOCK */
+static uint8_t bcd_to_bin(uint8_t value) { return value - 6 * (value >> 4); }
+static uint8_t bin_to_bcd(uint8_t value) { return value + 6 * (value / 10); }
+
+bool HalClock::begin()
+{
+  // the display normally sets the bus up first, this covers the RTC being used on its own
+  i2c_async_begin(I2C_CLOCK_HZ);
+  return i2c_probe(RTC_ADDRESS);
+}
+
+bool HalClock::isrunning()
+{
+  uint8_t seconds = RTC_CLOCK_HALT;
+  i2c_read_registers(RTC_ADDRESS, 0, &seconds, 1);
+  return !(seconds & RTC_CLOCK_HALT);
+}
+
+HalDateTime HalClock::now()
+{
+  // seconds, minutes, hours, day of week, date, month, year
+  uint8_t registers[7] = {0, 0, 0, 0, 1, 1, 0};
+  i2c_read_registers(RTC_ADDRESS, 0, registers, sizeof(registers));
+
+  return HalDateTime(bcd_to_bin(registers[6]) + 2000, bcd_to_bin(registers[5]), bcd_to_bin(registers[4]),
+                     bcd_to_bin(registers[2]), bcd_to_bin(registers[1]), bcd_to_bin(registers[0] & 0x7F));
+}
+
+//+ Writes RTC registers and waits until they are sent; a queue full of LCD output is sent first to make room, as
+// dropping a write here would lose a clock setting or the square wave that wakes the MCU
+static void rtc_write(const uint8_t *registers, uint8_t length)
+{
+  if (!i2c_async_write(RTC_ADDRESS, registers, length))
+  {
+    i2c_async_flush();
+    i2c_async_write(RTC_ADDRESS, registers, length);
+  }
+  i2c_async_flush();
+}
+
+void HalClock::adjust(const HalDateTime &dt)
+{
+  // the DS1307 counts the days of the week from 1 (Sunday)
+  uint8_t day_of_week = dt.dayOfTheWeek() + 1;
+
+  // writing the seconds register also clears the clock halt bit
+  uint8_t registers[8] = {0,
+                          bin_to_bcd(dt.second()),
+                          bin_to_bcd(dt.minute()),
+                          bin_to_bcd(dt.hour()),
+                          day_of_week,
+                          bin_to_bcd(dt.day()),
+                          bin_to_bcd(dt.month()),
+                          bin_to_bcd(dt.year() - 2000)};
+
+  rtc_write(registers, sizeof(registers));
+}
+
+void HalClock::square_wave(bool enable)
+{
+  uint8_t registers[2] = {RTC_CONTROL, enable ? RTC_SQW_1HZ : 0};
+
+  rtc_write(registers, sizeof(registers));
+}
+
+/* STORAGE */
+// Written from the EEPROM ready interrupt, one byte each time the EEPROM finishes the previous one
+static EepromQueue eeprom_queue;
+
+uint8_t HalStorage::read(int address)
+{
+  uint8_t value;
+
+  while (true)
+  {
+    // the byte being written (about 3.4 ms) is waited out with the interrupts on, so no tick or received byte is lost
+    while (EECR & _BV(EEPE))
+    {
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+    // unless the EEPROM ready interrupt started the next byte in between, the read does not wait and the queue can not
+    // change under the lookup
+    if (!(EECR & _BV(EEPE)))
+    {
+      if (!eeprom_queue.find(address, value))
+      {
+        value = EEPROM.read(address);
+      }
+      SREG = sreg;
+      return value;
+    }
+    SREG = sreg;
+  }
+}
+
+void HalStorage::update(int address, uint8_t value)
+{
+  if (read(address) == value)
+  {
+    return;
+  }
+
+  // only a compaction of the settings log fills the queue, the interrupt makes room
+  while (eeprom_queue.full())
+  {
+  }
+
+  uint8_t sreg = SREG;
+  cli();
+  eeprom_queue.push(address, value);
+  EECR |= _BV(EERIE);
+  SREG = sreg;
+}
+
+bool HalStorage::pending()
+{
+  return !eeprom_queue.empty() || (EECR & _BV(EEPE));
+}
+
+void HalStorage::flush()
+{
+  while (pending())
+  {
+  }
+}
+
+int HalStorage::length() { return EEPROM.length(); }
+
+ISR(EE_READY_vect)
+{
+  uint16_t address;
+  uint8_t value;
+
+  if (!eeprom_queue.pop(address, value))
+  {
+    // nothing left to write, the interrupt stays off until the next update()
+    EECR &= ~_BV(EERIE);
+    return;
+  }
+
+  // an erase and write of the byte, EEPE has to be set within 4 cycles of EEMPE
+  EEAR = address;
+  EEDR = value;
+  EECR = (EECR & ~(_BV(EEPM1) | _BV(EEPM0))) | _BV(EEMPE);
+  EECR |= _BV(EEPE);
+}
+
+/* BUTTONS */
+// Changes of the debounced levels, written by the timer interrupt (a power of 2)
+static const uint8_t INPUT_QUEUE_SIZE = 16;
+static HalInputSample input_queue[INPUT_QUEUE_SIZE];
+static volatile uint8_t input_head = 0;
+static volatile uint8_t input_tail = 0;
+static uint8_t input_mask = 0;
+
+static VerticalDebounce input_debounce;
+static uint8_t input_ticks = 0;
+
+void hal_input_begin(uint8_t pin_mask)
+{
+  DDRD &= ~pin_mask;
+  input_debounce.begin(PIND & pin_mask);
+  input_mask = pin_mask;
+
+  // the compare B interrupt of Timer0 runs once per overflow (every 1.024ms) next to millis(), its pin (OC0B, pin 5)
+  // stays a plain input as the COM0B bits are left clear
+  OCR0B = 0x80;
+  TIFR0 = _BV(OCF0B);
+  TIMSK0 |= _BV(OCIE0B);
+}
+
+uint8_t hal_input_levels() { return input_debounce.levels(); }
+
+bool hal_input_next(HalInputSample &sample)
+{
+  bool found = false;
+
+  uint8_t sreg = SREG;
+  cli();
+  if (input_head != input_tail)
+  {
+    sample = input_queue[input_tail];
+    input_tail = (input_tail + 1) & (INPUT_QUEUE_SIZE - 1);
+    found = true;
+  }
+  SREG = sreg;
+
+  return found;
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+  if (++input_ticks < HAL_INPUT_SAMPLE_MS)
+  {
+    return;
+  }
+  input_ticks = 0;
+
+  if (input_debounce.sample(PIND & input_mask) == 0)
+  {
+    return;
+  }
+
+  uint8_t next = (input_head + 1) & (INPUT_QUEUE_SIZE - 1);
+  uint8_t slot = next == input_tail ? (input_head - 1) & (INPUT_QUEUE_SIZE - 1) : input_head;
+
+  // when full the newest change is overwritten, so the last levels are never lost
+  input_queue[slot].levels = input_debounce.levels();
+  input_queue[slot].time_ms = millis();
+  if (slot == input_head)
+  {
+    input_head = next;
+  }
+}
+
+/* POWER */
+// Kept up to date by the Arduino core's Timer0 interrupt, moved on by hal_sleep() as Timer0 stops in power down
+extern volatile unsigned long timer0_millis;
+
+// The square wave pin on PORTC (PCINT8-13 are PC0-5)
+static uint8_t sqw_mask = 0;
+
+/* Set by the interrupts that can end a power down */
+static volatile bool woke_tick = false;
+static volatile bool woke_button = false;
+static volatile bool woke_timeout = false;
+static volatile bool woke_serial = false;
+
+// The levels of the button pins when the power down started
+static volatile uint8_t sleep_levels = 0;
+
+void hal_sleep_begin(uint8_t sqw_pin)
+{
+  pinMode(sqw_pin, INPUT_PULLUP);
+  sqw_mask = digitalPinToBitMask(sqw_pin);
+
+  PCMSK1 |= sqw_mask;
+  PCIFR = _BV(PCIF1);
+  PCICR |= _BV(PCIE1);
+}
+
+ISR(PCINT1_vect)
+{
+  // both edges interrupt, the RTC second starts on the falling one
+  if (!(PINC & sqw_mask))
+  {
+    woke_tick = true;
+  }
+}
+
+ISR(PCINT2_vect)
+{
+  uint8_t pins = PIND;
+
+  // the serial RX pin (PD0) going low is the start bit of a character
+  if ((pins & input_mask) != sleep_levels)
+  {
+    woke_button = true;
+  }
+  if (!(pins & _BV(PD0)))
+  {
+    woke_serial = true;
+  }
+}
+
+ISR(WDT_vect) { woke_timeout = true; }
+
+uint8_t hal_sleep(unsigned long tick_ms)
+{
+  // a tick during the waits below still counts, so the flags are cleared first
+  cli();
+  woke_tick = false;
+  woke_button = false;
+  woke_timeout = false;
+  woke_serial = false;
+  sei();
+
+  // the UART, the TWI and the EEPROM all stop (or keep the oscillator running) in power down
+  Serial.flush();
+  i2c_async_flush();
+  HalStorage().flush();
+
+  // input that already came in is not waited for
+  if (Serial.available() > 0)
+  {
+    return HAL_WAKE_SERIAL;
+  }
+
+  // the watchdog below is started after the writes, so that is where its timeout counts from
+  unsigned long start_ms = millis();
+
+  // the buttons and the RX pin only interrupt while powered down, awake the buttons are debounced by Timer0
+  sleep_levels = PIND & input_mask;
+  PCMSK2 = input_mask | _BV(PCINT16);
+  PCIFR = _BV(PCIF2);
+  PCICR |= _BV(PCIE2);
+
+  // the watchdog ends the power down if the square wave never comes
+  cli();
+  wdt_reset();
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDIE) | _BV(WDP2) | _BV(WDP1) | _BV(WDP0);
+  sei();
+
+  // the ADC would keep drawing current while enabled
+  uint8_t adc_control = ADCSRA;
+  ADCSRA = adc_control & ~_BV(ADEN);
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  for (;;)
+  {
+    // the check and the sleep are atomic, sei() only takes effect after the next instruction
+    cli();
+    if (woke_tick || woke_button || woke_timeout || woke_serial)
+    {
+      sei();
+      break;
+    }
+    sleep_enable();
+#ifdef sleep_bod_disable
+    sleep_bod_disable();
+#endif
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    // the rising edge half way through the second wakes up here too and goes back to sleep
+  }
+
+  wdt_disable();
+  PCICR &= ~_BV(PCIE2);
+  ADCSRA = adc_control;
+
+  uint8_t reason = HAL_WAKE_BUTTON;
+  unsigned long wake_ms = start_ms;
+  if (woke_tick)
+  {
+    reason = HAL_WAKE_TICK;
+    wake_ms = tick_ms;
+  }
+  else if (woke_timeout)
+  {
+    reason = HAL_WAKE_TIMEOUT;
+    wake_ms = start_ms + HAL_SLEEP_TIMEOUT_MS;
+  }
+  else if (woke_serial)
+  {
+    reason = HAL_WAKE_SERIAL;
+  }
+
+  // micros() is left behind, it is only used to time short stretches while awake
+  cli();
+  if ((long)(timer0_millis - wake_ms) < 0)
+  {
+    timer0_millis = wake_ms;
+  }
+  sei();
+
+  return reason;
+}
+
+/* SERIAL */
+void HalSerial::begin(unsigned long baud) { Serial.begin(baud); }
+void HalSerial::flush() { Serial.flush(); }
+int HalSerial::available() { return Serial.available(); }
+int HalSerial::read() { return Serial.read(); }
+int HalSerial::availableForWrite() { return Serial.availableForWrite(); }
+size_t HalSerial::print(const __FlashStringHelper *str) { return Serial.print(str); }
+size_t HalSerial::print(const char *str) { return Serial.print(str); }
+size_t HalSerial::print(long value) { return Serial.print(value); }
+size_t HalSerial::println(const __FlashStringHelper *str) { return Serial.println(str); }
+size_t HalSerial::println(const char *str) { return Serial.println(str); }
+size_t HalSerial::println(long value) { return Serial.println(value); }
+size_t HalSerial::println() { return Serial.println(); }
@@ -0,0 +1,166 @@
+/*
+*Overview: The platform independent parts of the hardware abstraction layer (calendar arithmetic for HalDateTime).
+*/
+
+#include "hal.h"
+
+/* Number of days in each month of a non leap year */
+static const uint8_t days_in_month[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+static bool is_leap_year(uint16_t year_offset)
+{
+  // only valid between 2000 and 2099, same as the DS1307
+  return (year_offset % 4) == 0;
+}
+
+static uint8_t month_length(uint16_t year_offset, uint8_t month)
+{
+  if (month == 2 && is_leap_year(year_offset))
+  {
+    return 29;
+  }
+  return days_in_month[month - 1];
+}
+
+//+ Number of days since 1 Jan 2000
+static uint16_t date_to_days(uint16_t year_offset, uint8_t month, uint8_t day)
+{
+  uint16_t days = day - 1;
+  for (uint8_t i = 1; i < month; i++)
+  {
+    days += month_length(year_offset, i);
+  }
+  return days + 365 * year_offset + (year_offset + 3) / 4;
+}
+
+//+ Converts a 2 digit string into an integer
+static uint8_t conv2d(const char *p)
+{
+  uint8_t v = 0;
+  if ('0' <= *p && *p <= '9')
+  {
+    v = *p - '0';
+  }
+  return 10 * v + *++p - '0';
+}
+
+HalDateTime::HalDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+  if (year >= 2000)
+  {
+    year -= 2000;
+  }
+  yOff = year;
+  m = month;
+  d = day;
+  hh = hour;
+  mm = minute;
+  ss = second;
+}
+
+HalDateTime HalDateTime::from_seconds(uint32_t seconds)
+{
+  uint8_t second = seconds % 60;
+  seconds /= 60;
+  uint8_t minute = seconds % 60;
+  seconds /= 60;
+  uint8_t hour = seconds % 24;
+  uint16_t days = seconds / 24;
+
+  uint8_t year_offset = 0;
+  for (;; year_offset++)
+  {
+    uint16_t year_length = is_leap_year(year_offset) ? 366 : 365;
+    if (days < year_length)
+    {
+      break;
+    }
+    days -= year_length;
+  }
+
+  uint8_t month = 1;
+  for (;; month++)
+  {
+    uint8_t length = month_length(year_offset, month);
+    if (days < length)
+    {
+      break;
+    }
+    days -= length;
+  }
+
+  return HalDateTime(year_offset, month, days + 1, hour, minute, second);
+}
+
+HalDateTime HalDateTime::build_time()
+{
+  // __DATE__ is of the format "Dec 26 2021" and __TIME__ is "12:34:56"
+  static const char date[] = __DATE__;
+  static const char time[] = __TIME__;
+
+  uint8_t month = 0;
+  switch (date[0])
+  {
+  case 'J':
+    month = (date[1] == 'a') ? 1 : ((date[2] == 'n') ? 6 : 7);
+    break;
+  case 'F':
+    month = 2;
+    break;
+  case 'A':
+    month = date[2] == 'r' ? 4 : 8;
+    break;
+  case 'M':
+    month = date[2] == 'r' ? 3 : 5;
+    break;
+  case 'S':
+    month = 9;
+    break;
+  case 'O':
+    month = 10;
+    break;
+  case 'N':
+    month = 11;
+    break;
+  case 'D':
+    month = 12;
+    break;
+  }
+
+  return HalDateTime(conv2d(date + 9), month, conv2d(date + 4), conv2d(time), conv2d(time + 3), conv2d(time + 6));
+}
+
+uint32_t HalDateTime::seconds() const
+{
+  uint32_t days = date_to_days(yOff, m, d);
+  return ((days * 24UL + hh) * 60 + mm) * 60 + ss;
+}
+
+uint8_t HalDateTime::dayOfTheWeek() const
+{
+  // 1 Jan 2000 was a Saturday
+  return (date_to_days(yOff, m, d) + 6) % 7;
+}
+
+uint16_t HalDateTime::calendar_day() const
+{
+  // the days of the months before in 2000, a leap year
+  return date_to_days(0, m, d);
+}
+
+bool HalDateTime::isValid() const
+{
+  if (yOff >= 100)
+  {
+    return false;
+  }
+  if (m < 1 || m > 12)
+  {
+    return false;
+  }
+  if (d < 1 || d > month_length(yOff, m))
+  {
+    return false;
+  }
+  return hh < 24 && mm < 60 && ss < 60;
+}
@@ -0,0 +1,683 @@
+/*
+*Overview: Host implementation of the hardware abstraction layer. The hardware is simulated in memory and time is
+*          virtual: it only moves when the host entry point calls host_advance_us() or the firmware calls hal_delay().
+*          A power down in hal_sleep() jumps the virtual time to the next square wave tick or scheduled button change,
+*          with millis() standing still over it as on the Uno.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "eeprom_queue.h"
+#include "hal_host.h"
+#include "sample_ring.h"
+#include "vertical_debounce.h"
+
+/* Simulated hardware state */
+static const uint8_t NUM_PINS = 20;
+static const int EEPROM_SIZE = 1024;
+static const uint8_t LCD_COLS = 40; // DDRAM width of a HD44780 row, only the first 16 are visible
+static const uint8_t LCD_VISIBLE_COLS = 16;
+
+/* Approximate bus costs at 100kHz I2C, charged to the virtual time */
+static const unsigned long RTC_READ_US = 1000;   // DS1307 register read of 7 bytes
+static const unsigned long LCD_BYTE_US = 600;    // one byte through the PCF8574 backpack in 4-bit mode
+static const unsigned long LCD_CLEAR_US = 2000;  // clear display instruction
+static const unsigned long EEPROM_WRITE_US = 3300; // erase and write of one EEPROM byte
+
+static unsigned long long time_us = 0;
+
+// hal_millis() and hal_micros() lag the virtual time by this much after power downs that millis() missed
+static long long millis_lag_us = 0;
+
+// Virtual time spent powered down, when no CPU cycles are counted
+static unsigned long long asleep_us = 0;
+
+static uint32_t rtc_seconds_at_set = 0;
+static unsigned long long rtc_time_us_at_set = 0;
+static bool rtc_running = true;
+static long rtc_drift_ppm = 0;
+static bool rtc_square_wave = false;
+
+static uint8_t pin_levels[NUM_PINS];
+static int adc_values[NUM_PINS];
+
+/* The sampled analog pin, one sample every Timer0 overflow like on the Uno */
+static const unsigned long ADC_SAMPLE_US = 1024;
+static uint8_t adc_pin = NUM_PINS;
+static SampleRing adc_ring;
+static unsigned long long adc_next_sample_us = 0;
+
+// A fresh EEPROM reads 0xFF, but the firmware expects an initialised device so the host starts with zeros
+static uint8_t eeprom[EEPROM_SIZE];
+
+/* Queued EEPROM writes, the oldest one completes at eeprom_ready_us */
+static EepromQueue eeprom_queue;
+static unsigned long long eeprom_ready_us = 0;
+static unsigned long eeprom_bytes_written = 0;
+
+static char lcd_ddram[2][LCD_COLS];
+static char lcd_rows[2][LCD_VISIBLE_COLS + 1];
+static uint8_t lcd_col = 0;
+static uint8_t lcd_row = 0;
+static unsigned long lcd_bytes_written = 0;
+
+/* TIMING */
+unsigned long hal_millis() { return (unsigned long)((time_us - millis_lag_us) / 1000); }
+unsigned long hal_micros() { return (unsigned long)(time_us - millis_lag_us); }
+void hal_delay(unsigned long ms) { time_us += ms * 1000ULL; }
+void hal_delay_us(unsigned int us) { time_us += us; }
+
+void host_advance_us(unsigned long us) { time_us += us; }
+
+#ifdef HAL_CYCLES
+// Cycles of a 16MHz Uno over the virtual time, so only the simulated hardware costs show up
+void hal_cycles_begin() {}
+uint32_t hal_cycles() { return (uint32_t)((time_us - asleep_us) * 16); }
+#endif
+
+#ifdef KERNEL_BENCH
+/* The painted stack is a local array of hal_stack_paint(), which the calls after it reuse */
+static const size_t STACK_PAINT_BYTES = 64 * 1024;
+static const uint8_t STACK_PAINT = 0xA5;
+static uintptr_t stack_painted_low = 0;
+static uintptr_t stack_painted_top = 0;
+
+void hal_stack_paint()
+{
+  volatile uint8_t area[STACK_PAINT_BYTES];
+  for (size_t i = 0; i < STACK_PAINT_BYTES; i++)
+  {
+    area[i] = STACK_PAINT;
+  }
+  stack_painted_low = (uintptr_t)area;
+  stack_painted_top = stack_painted_low + STACK_PAINT_BYTES;
+}
+
+uint16_t hal_stack_used()
+{
+  const volatile uint8_t *p = (const volatile uint8_t *)stack_painted_low;
+  while ((uintptr_t)p < stack_painted_top && *p == STACK_PAINT)
+  {
+    p++;
+  }
+  return (uint16_t)(stack_painted_top - (uintptr_t)p);
+}
+#endif
+
+/* GPIO AND ADC */
+void hal_gpio_mode(uint8_t pin, uint8_t mode)
+{
+  (void)pin;
+  (void)mode;
+}
+
+void hal_gpio_write(uint8_t pin, uint8_t level)
+{
+  if (pin < NUM_PINS)
+  {
+    pin_levels[pin] = level;
+  }
+}
+
+uint8_t hal_gpio_read(uint8_t pin) { return pin < NUM_PINS ? pin_levels[pin] : LOW; }
+
+void hal_gpio_pwm(uint8_t pin, uint8_t duty) { hal_gpio_write(pin, duty); }
+
+void hal_adc_start(uint8_t pin)
+{
+  adc_pin = pin;
+  adc_next_sample_us = time_us;
+}
+
+uint16_t hal_adc_average()
+{
+  if (adc_pin >= NUM_PINS)
+  {
+    return 0;
+  }
+
+  // takes the samples the interrupt would have taken since the last call, only the last ring full matters
+  unsigned long long ring_span_us = SampleRing::SIZE * ADC_SAMPLE_US;
+  if (time_us >= adc_next_sample_us + ring_span_us)
+  {
+    adc_next_sample_us = time_us - ring_span_us + ADC_SAMPLE_US;
+  }
+  while (adc_next_sample_us <= time_us)
+  {
+    adc_ring.add(adc_values[adc_pin]);
+    adc_next_sample_us += ADC_SAMPLE_US;
+  }
+  return adc_ring.average();
+}
+
+void host_set_adc(uint8_t pin, int value)
+{
+  if (pin < NUM_PINS)
+  {
+    adc_values[pin] = value;
+  }
+}
+
+uint8_t host_get_pin(uint8_t pin) { return hal_gpio_read(pin); }
+
+/* DISPLAY */
+static void lcd_write(char c)
+{
+  lcd_bytes_written++;
+  time_us += LCD_BYTE_US;
+  if (lcd_col < LCD_COLS)
+  {
+    lcd_ddram[lcd_row][lcd_col] = c;
+  }
+  lcd_col++;
+}
+
+void HalDisplay::begin(uint8_t cols, uint8_t rows)
+{
+  (void)cols;
+  (void)rows;
+  clear();
+}
+
+void HalDisplay::clear()
+{
+  lcd_bytes_written++;
+  time_us += LCD_CLEAR_US;
+  memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+  lcd_col = 0;
+  lcd_row = 0;
+}
+
+void HalDisplay::setCursor(uint8_t col, uint8_t row)
+{
+  lcd_bytes_written++;
+  time_us += LCD_BYTE_US;
+  lcd_col = col;
+  lcd_row = row > 1 ? 1 : row;
+}
+
+void HalDisplay::cursor()
+{
+  lcd_bytes_written++;
+  time_us += LCD_BYTE_US;
+}
+
+void HalDisplay::noCursor()
+{
+  lcd_bytes_written++;
+  time_us += LCD_BYTE_US;
+}
+
+void HalDisplay::write(char c) { lcd_write(c); }
+
+// the host display is written straight away
+bool HalDisplay::ready() { return true; }
+
+HalBusStats HalDisplay::bus_stats()
+{
+  HalBusStats stats = {0, 0, 0, 0, 0};
+  return stats;
+}
+
+const char *host_lcd_row(uint8_t row)
+{
+  row = row > 1 ? 1 : row;
+  memcpy(lcd_rows[row], lcd_ddram[row], LCD_VISIBLE_COLS);
+  lcd_rows[row][LCD_VISIBLE_COLS] = '\0';
+  return lcd_rows[row];
+}
+
+unsigned long host_lcd_writes() { return lcd_bytes_written; }
+
+/* CLOCK */
+bool HalClock::begin() { return true; }
+bool HalClock::isrunning() { return rtc_running; }
+
+//+ The seconds count of the simulated RTC at the given virtual time
+static uint32_t rtc_seconds_at(unsigned long long at_us)
+{
+  long long elapsed_us = at_us - rtc_time_us_at_set;
+  elapsed_us += elapsed_us / 1000000LL * rtc_drift_ppm;
+  return rtc_seconds_at_set + (uint32_t)(elapsed_us / 1000000LL);
+}
+
+//+ The virtual time of the next seconds edge of the simulated RTC (the falling edge of its square wave)
+static unsigned long long rtc_next_edge_us()
+{
+  uint32_t second = rtc_seconds_at(time_us);
+
+  // the seconds are monotonic in the virtual time, and even a 2% fast or slow RTC ticks within 2 seconds
+  unsigned long long low = time_us;
+  unsigned long long high = time_us + 2000000ULL;
+  while (low + 1 < high)
+  {
+    unsigned long long middle = (low + high) / 2;
+    if (rtc_seconds_at(middle) != second)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle;
+    }
+  }
+  return high;
+}
+
+HalDateTime HalClock::now()
+{
+  time_us += RTC_READ_US;
+  return HalDateTime::from_seconds(rtc_seconds_at(time_us));
+}
+
+void HalClock::adjust(const HalDateTime &dt) { host_set_datetime(dt); }
+void HalClock::square_wave(bool enable) { rtc_square_wave = enable; }
+
+void host_set_datetime(const HalDateTime &dt)
+{
+  rtc_seconds_at_set = dt.seconds();
+  rtc_time_us_at_set = time_us;
+  rtc_running = true;
+}
+
+void host_set_rtc_drift(long ppm) { rtc_drift_ppm = ppm; }
+
+/* STORAGE */
+//+ Completes the queued writes whose time has passed, like the EEPROM ready interrupt does on the Uno
+static void eeprom_catch_up()
+{
+  uint16_t address;
+  uint8_t value;
+  while (time_us >= eeprom_ready_us && eeprom_queue.pop(address, value))
+  {
+    eeprom[address] = value;
+    eeprom_bytes_written++;
+    if (!eeprom_queue.empty())
+    {
+      eeprom_ready_us += EEPROM_WRITE_US;
+    }
+  }
+}
+
+uint8_t HalStorage::read(int address)
+{
+  if (address < 0 || address >= EEPROM_SIZE)
+  {
+    return 0xFF;
+  }
+
+  eeprom_catch_up();
+  uint8_t value;
+  return eeprom_queue.find(address, value) ? value : eeprom[address];
+}
+
+void HalStorage::update(int address, uint8_t value)
+{
+  if (address < 0 || address >= EEPROM_SIZE || read(address) == value)
+  {
+    return;
+  }
+
+  // waiting for room in the queue
+  while (eeprom_queue.full())
+  {
+    time_us = eeprom_ready_us;
+    eeprom_catch_up();
+  }
+
+  // a write onto an empty queue starts straight away (or once the last write is done)
+  if (eeprom_queue.empty())
+  {
+    eeprom_ready_us = (time_us > eeprom_ready_us ? time_us : eeprom_ready_us) + EEPROM_WRITE_US;
+  }
+  eeprom_queue.push(address, value);
+}
+
+unsigned long host_eeprom_writes() { return eeprom_bytes_written; }
+
+bool HalStorage::pending()
+{
+  eeprom_catch_up();
+  return !eeprom_queue.empty();
+}
+
+void HalStorage::flush()
+{
+  while (pending())
+  {
+    time_us = eeprom_ready_us;
+  }
+}
+
+int HalStorage::length() { return EEPROM_SIZE; }
+
+/* BUTTONS */
+// The timer interrupt that debounces the buttons on the Uno, run on the virtual time whenever the buttons are looked at
+static const unsigned long INPUT_SAMPLE_US = HAL_INPUT_SAMPLE_MS * 1024UL;
+static const uint8_t INPUT_QUEUE_SIZE = 16;
+static HalInputSample input_queue[INPUT_QUEUE_SIZE];
+static uint8_t input_head = 0;
+static uint8_t input_tail = 0;
+static uint8_t input_mask = 0;
+static VerticalDebounce input_debounce;
+static unsigned long long input_next_sample_us = 0;
+
+/* Pin changes scheduled ahead by the host entry point, they can wake the firmware from a power down */
+struct PinChange
+{
+  uint8_t pin;
+  uint8_t level;
+  unsigned long long at_us;
+};
+static const uint8_t PIN_CHANGES_SIZE = 16;
+static PinChange pin_changes[PIN_CHANGES_SIZE];
+static uint8_t pin_change_count = 0;
+
+//+ The raw levels of the button pins
+static uint8_t input_raw_levels()
+{
+  uint8_t levels = 0;
+  for (uint8_t pin = 0; pin < 8; pin++)
+  {
+    if (pin_levels[pin] != LOW)
+    {
+      levels |= 1 << pin;
+    }
+  }
+  return levels & input_mask;
+}
+
+//+ The earliest scheduled pin change, PIN_CHANGES_SIZE if there is none
+static uint8_t next_pin_change()
+{
+  uint8_t earliest = PIN_CHANGES_SIZE;
+  for (uint8_t i = 0; i < pin_change_count; i++)
+  {
+    if (earliest == PIN_CHANGES_SIZE || pin_changes[i].at_us < pin_changes[earliest].at_us)
+    {
+      earliest = i;
+    }
+  }
+  return earliest;
+}
+
+//+ Runs the samples of the timer interrupt up to until_us on the pin levels as they are
+static void input_sample_until(unsigned long long until_us)
+{
+  uint8_t raw = input_raw_levels();
+
+  // nothing can change while the pins agree with the debounced levels
+  if (raw == input_debounce.levels() && input_debounce.idle() && until_us >= input_next_sample_us)
+  {
+    input_next_sample_us += (until_us - input_next_sample_us) / INPUT_SAMPLE_US * INPUT_SAMPLE_US;
+  }
+
+  while (input_next_sample_us <= until_us)
+  {
+    if (input_debounce.sample(raw) != 0)
+    {
+      uint8_t next = (input_head + 1) & (INPUT_QUEUE_SIZE - 1);
+      uint8_t slot = next == input_tail ? (input_head - 1) & (INPUT_QUEUE_SIZE - 1) : input_head;
+
+      input_queue[slot].levels = input_debounce.levels();
+      input_queue[slot].time_ms = (unsigned long)((input_next_sample_us - millis_lag_us) / 1000);
+      if (slot == input_head)
+      {
+        input_head = next;
+      }
+    }
+    input_next_sample_us += INPUT_SAMPLE_US;
+  }
+}
+
+static void input_catch_up()
+{
+  // the scheduled changes that are due split the samples, a sample at the time of a change still sees the old level
+  uint8_t change = next_pin_change();
+  while (change < PIN_CHANGES_SIZE && pin_changes[change].at_us <= time_us)
+  {
+    input_sample_until(pin_changes[change].at_us);
+    hal_gpio_write(pin_changes[change].pin, pin_changes[change].level);
+    pin_changes[change] = pin_changes[--pin_change_count];
+    change = next_pin_change();
+  }
+  input_sample_until(time_us);
+}
+
+void hal_input_begin(uint8_t pin_mask)
+{
+  input_mask = pin_mask;
+  input_debounce.begin(input_raw_levels());
+  input_next_sample_us = time_us + INPUT_SAMPLE_US;
+}
+
+uint8_t hal_input_levels()
+{
+  input_catch_up();
+  return input_debounce.levels();
+}
+
+bool hal_input_next(HalInputSample &sample)
+{
+  input_catch_up();
+  if (input_head == input_tail)
+  {
+    return false;
+  }
+  sample = input_queue[input_tail];
+  input_tail = (input_tail + 1) & (INPUT_QUEUE_SIZE - 1);
+  return true;
+}
+
+void host_set_pin(uint8_t pin, uint8_t level)
+{
+  // the samples up to now still see the old level
+  input_catch_up();
+  hal_gpio_write(pin, level);
+}
+
+bool host_set_pin_at(uint8_t pin, uint8_t level, unsigned long delay_us)
+{
+  if (pin_change_count == PIN_CHANGES_SIZE)
+  {
+    return false;
+  }
+  PinChange &change = pin_changes[pin_change_count++];
+  change.pin = pin;
+  change.level = level;
+  change.at_us = time_us + delay_us;
+  return true;
+}
+
+/* POWER */
+static bool sqw_wired = false;
+static bool trace_power = false;
+static void (*power_down_hook)() = NULL;
+
+void hal_sleep_begin(uint8_t sqw_pin)
+{
+  (void)sqw_pin;
+  sqw_wired = true;
+}
+
+uint8_t hal_sleep(unsigned long tick_ms)
+{
+  // the background writes finish first, and the buttons are sampled up to the power down
+  HalStorage().flush();
+  input_catch_up();
+
+  // input that already came in is not waited for
+  if (HalSerial().available() > 0)
+  {
+    return HAL_WAKE_SERIAL;
+  }
+
+  // the watchdog timeout counts from after the writes
+  unsigned long start_ms = hal_millis();
+
+  if (power_down_hook != NULL)
+  {
+    power_down_hook();
+  }
+
+  // the first of the next square wave tick, a change of a button pin and the watchdog
+  uint8_t reason = HAL_WAKE_TIMEOUT;
+  unsigned long long wake_us = time_us + HAL_SLEEP_TIMEOUT_MS * 1000ULL;
+  if (sqw_wired && rtc_square_wave && rtc_running)
+  {
+    unsigned long long edge_us = rtc_next_edge_us();
+    if (edge_us < wake_us)
+    {
+      reason = HAL_WAKE_TICK;
+      wake_us = edge_us;
+    }
+  }
+  for (uint8_t i = 0; i < pin_change_count; i++)
+  {
+    const PinChange &change = pin_changes[i];
+    bool is_button = change.pin < 8 && (input_mask & (1 << change.pin));
+    if (is_button && change.level != pin_levels[change.pin] && change.at_us <= wake_us)
+    {
+      reason = HAL_WAKE_BUTTON;
+      wake_us = change.at_us;
+    }
+  }
+
+  // Timer0 stops, so millis(), the button samples and the ADC samples all stand still
+  unsigned long long slept_us = wake_us - time_us;
+  asleep_us += slept_us;
+  millis_lag_us += slept_us;
+  input_next_sample_us += slept_us;
+  adc_next_sample_us += slept_us;
+  time_us = wake_us;
+
+  unsigned long wake_ms = reason == HAL_WAKE_TICK ? tick_ms : reason == HAL_WAKE_TIMEOUT ? start_ms + HAL_SLEEP_TIMEOUT_MS
+                                                                                         : start_ms;
+  if ((long)(hal_millis() - wake_ms) < 0)
+  {
+    millis_lag_us = (long long)time_us - (long long)wake_ms * 1000;
+  }
+
+  if (trace_power)
+  {
+    static const char *const REASONS[] = {"tick", "button", "timeout", "serial"};
+    printf("%10.3f  powered down %7.3fms, woke on %s (millis %+.3fms)\n", time_us / 1e6, slept_us / 1e3,
+           REASONS[reason], -millis_lag_us / 1e3);
+  }
+  return reason;
+}
+
+void host_trace_power(bool enable) { trace_power = enable; }
+
+void host_on_power_down(void (*hook)()) { power_down_hook = hook; }
+
+unsigned long long host_asleep_us() { return asleep_us; }
+
+unsigned long long host_time_us() { return time_us; }
+
+/* SERIAL */
+// Bytes waiting to be read by the firmware, queued by host_serial_input()
+static const uint8_t SERIAL_RX_SIZE = 64;
+static char serial_rx[SERIAL_RX_SIZE];
+static uint8_t serial_rx_head = 0;
+static uint8_t serial_rx_tail = 0;
+
+void HalSerial::begin(unsigned long baud) { (void)baud; }
+void HalSerial::flush() { fflush(stdout); }
+int HalSerial::available() { return (uint8_t)(serial_rx_head - serial_rx_tail) % SERIAL_RX_SIZE; }
+
+int HalSerial::read()
+{
+  if (serial_rx_head == serial_rx_tail)
+  {
+    return -1;
+  }
+  char c = serial_rx[serial_rx_tail];
+  serial_rx_tail = (serial_rx_tail + 1) % SERIAL_RX_SIZE;
+  return (uint8_t)c;
+}
+
+// stdout never fills up, this is the free space of the Uno's empty transmit buffer
+int HalSerial::availableForWrite() { return 63; }
+
+bool host_serial_input(const char *text)
+{
+  for (; *text != '\0'; text++)
+  {
+    uint8_t next = (serial_rx_head + 1) % SERIAL_RX_SIZE;
+    if (next == serial_rx_tail)
+    {
+      return false;
+    }
+    serial_rx[serial_rx_head] = *text;
+    serial_rx_head = next;
+  }
+  return true;
+}
+// Transmitted text held for host_serial_line() while capturing, instead of going to stdout
+static bool serial_capture = false;
+static const uint16_t SERIAL_TX_SIZE = 256;
+static char serial_tx[SERIAL_TX_SIZE];
+static uint16_t serial_tx_length = 0;
+
+static size_t serial_write(const char *text)
+{
+  size_t length = strlen(text);
+  if (!serial_capture)
+  {
+    return fputs(text, stdout) < 0 ? 0 : length;
+  }
+  // a line longer than the buffer is cut, the end of it is lost
+  for (size_t i = 0; i < length && serial_tx_length < SERIAL_TX_SIZE; i++)
+  {
+    serial_tx[serial_tx_length++] = text[i];
+  }
+  return length;
+}
+
+void host_capture_serial(bool enable) { serial_capture = enable; }
+
+bool host_serial_line(char *line, size_t size)
+{
+  uint16_t end = 0;
+  while (end < serial_tx_length && serial_tx[end] != '\n')
+  {
+    end++;
+  }
+  if (end == serial_tx_length && serial_tx_length < SERIAL_TX_SIZE)
+  {
+    return false;
+  }
+
+  uint16_t copied = 0;
+  for (uint16_t i = 0; i < end && (size_t)copied + 1 < size; i++)
+  {
+    if (serial_tx[i] != '\r')
+    {
+      line[copied++] = serial_tx[i];
+    }
+  }
+  line[copied] = '\0';
+
+  uint16_t next = end < serial_tx_length ? end + 1 : end;
+  memmove(serial_tx, serial_tx + next, serial_tx_length - next);
+  serial_tx_length -= next;
+  return true;
+}
+
+size_t HalSerial::print(const __FlashStringHelper *str) { return print(reinterpret_cast<const char *>(str)); }
+size_t HalSerial::print(const char *str) { return serial_write(str); }
+
+size_t HalSerial::print(long value)
+{
+  char text[12];
+  snprintf(text, sizeof(text), "%ld", value);
+  return serial_write(text);
+}
+
+size_t HalSerial::println(const __FlashStringHelper *str) { return print(str) + println(); }
+size_t HalSerial::println(const char *str) { return print(str) + println(); }
+size_t HalSerial::println(long value) { return print(value) + println(); }
+size_t HalSerial::println() { return print("\r\n"); }
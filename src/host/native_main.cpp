@@ -0,0 +1,44 @@
+/*
+*Overview: Host entry point for [env:native]. Runs setup() and loop() against the simulated hardware for a number of
+*          virtual seconds so the firmware can be profiled on a PC (e.g. with perf or gprof).
+*
+*Usage: program [seconds to simulate] [ADC counts on A0] [1 to print the power down timeline]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hal_host.h"
+
+// Virtual time spent outside the firmware on each pass of loop(), roughly the Arduino core overhead
+static const unsigned long LOOP_OVERHEAD_US = 10;
+
+int main(int argc, char **argv)
+{
+  unsigned long seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 60;
+  int adc_counts = argc > 2 ? atoi(argv[2]) : 712; // ~12.6V through the voltage divider
+  host_trace_power(argc > 3 && atoi(argv[3]) != 0);
+
+  host_set_datetime(HalDateTime(2022, 1, 1, 12, 0, 0));
+  host_set_adc(A0, adc_counts);
+
+  setup();
+
+  unsigned long passes = 0;
+  unsigned long long end_us = host_time_us() + seconds * 1000000ULL;
+  while (host_time_us() < end_us)
+  {
+    loop();
+    host_advance_us(LOOP_OVERHEAD_US);
+    passes++;
+  }
+
+  printf("simulated %lus: %lu loop passes, %lu LCD writes\n", seconds, passes, host_lcd_writes());
+  printf("[%s]\n[%s]\n", host_lcd_row(0), host_lcd_row(1));
+
+  unsigned long long asleep_us = host_asleep_us();
+  printf("powered down %.3fs, awake %.1fms per second\n", asleep_us / 1e6,
+         (seconds * 1e6 - asleep_us) / seconds / 1e3);
+
+  return 0;
+}
@@ -0,0 +1,250 @@
+/*
+*Overview: AVR implementation of the interrupt driven I2C master (replaces the Wire library).
+*/
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/twi.h>
+
+#include "i2c_async.h"
+
+#define QUEUE_MASK (I2C_QUEUE_SIZE - 1)
+
+/* Polled transfers give up after this many status checks (a few ms at 16MHz) */
+static const uint16_t POLL_LIMIT = 20000;
+
+static uint8_t queue[I2C_QUEUE_SIZE];
+static volatile uint8_t head = 0; // written by the callers
+static volatile uint8_t tail = 0; // written by the interrupt
+static volatile bool busy = false;
+static bool initialised = false;
+
+/* the transfer in progress */
+static volatile uint8_t current_address = 0;
+static volatile uint8_t remaining = 0;
+
+static uint8_t peak = 0;
+static uint16_t overflows = 0;
+static volatile uint16_t errors = 0;
+
+static uint8_t queue_depth()
+{
+  return (uint8_t)(head - tail) & QUEUE_MASK;
+}
+
+void i2c_async_begin(uint32_t clock_hz)
+{
+  if (initialised)
+  {
+    return;
+  }
+  initialised = true;
+
+  // the internal pull ups on SDA (A4) and SCL (A5) are switched on, as the Wire library does
+  PORTC |= _BV(PC4) | _BV(PC5);
+
+  TWSR = 0; // prescaler of 1
+  TWBR = ((F_CPU / clock_hz) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+uint8_t i2c_async_room()
+{
+  return I2C_QUEUE_SIZE - 1 - queue_depth();
+}
+
+bool i2c_async_write(uint8_t address, const uint8_t *data, uint8_t length)
+{
+  if (i2c_async_room() < length + 2)
+  {
+    overflows++;
+    return false;
+  }
+
+  uint8_t index = head;
+  queue[index] = address;
+  index = (index + 1) & QUEUE_MASK;
+  queue[index] = length;
+  index = (index + 1) & QUEUE_MASK;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    queue[index] = data[i];
+    index = (index + 1) & QUEUE_MASK;
+  }
+
+  // the record only becomes visible to the interrupt once it is complete
+  head = index;
+
+  uint8_t depth = queue_depth();
+  if (depth > peak)
+  {
+    peak = depth;
+  }
+
+  uint8_t sreg = SREG;
+  cli();
+  if (!busy)
+  {
+    // a STOP from the previous transfer may still be going out
+    while (TWCR & _BV(TWSTO))
+    {
+    }
+    busy = true;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+  }
+  SREG = sreg;
+
+  return true;
+}
+
+void i2c_async_flush()
+{
+  while (busy)
+  {
+  }
+  while (TWCR & _BV(TWSTO))
+  {
+  }
+}
+
+I2cQueueStats i2c_async_stats()
+{
+  I2cQueueStats stats;
+
+  uint8_t sreg = SREG;
+  cli();
+  stats.depth = queue_depth();
+  stats.peak = peak;
+  stats.overflows = overflows;
+  stats.errors = errors;
+  SREG = sreg;
+
+  return stats;
+}
+
+//+ Finishes the transfer in progress and starts the next one if there is one
+static void next_transfer(uint8_t stop)
+{
+  if (head != tail)
+  {
+    // a STOP followed by a START, or a repeated START
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA) | stop;
+  }
+  else
+  {
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+    busy = false;
+  }
+}
+
+ISR(TWI_vect)
+{
+  switch (TW_STATUS)
+  {
+  case TW_START:
+  case TW_REP_START:
+    current_address = queue[tail];
+    remaining = queue[(tail + 1) & QUEUE_MASK];
+    tail = (tail + 2) & QUEUE_MASK;
+    TWDR = (current_address << 1) | TW_WRITE;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    break;
+
+  case TW_MT_SLA_ACK:
+  case TW_MT_DATA_ACK:
+    if (remaining > 0)
+    {
+      TWDR = queue[tail];
+      tail = (tail + 1) & QUEUE_MASK;
+      remaining--;
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+    }
+    else
+    {
+      next_transfer(0);
+    }
+    break;
+
+  default:
+    // not acknowledged, arbitration lost or a bus error: the rest of this write is dropped
+    errors++;
+    tail = (tail + remaining) & QUEUE_MASK;
+    remaining = 0;
+    next_transfer(_BV(TWSTO));
+    break;
+  }
+}
+
+/* Polled transfers, only used while the queue is empty */
+static bool wait_for_twint()
+{
+  for (uint16_t i = 0; i < POLL_LIMIT; i++)
+  {
+    if (TWCR & _BV(TWINT))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool polled_start(uint8_t address_rw, uint8_t expected_ack)
+{
+  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTA);
+  if (!wait_for_twint() || (TW_STATUS != TW_START && TW_STATUS != TW_REP_START))
+  {
+    return false;
+  }
+
+  TWDR = address_rw;
+  TWCR = _BV(TWINT) | _BV(TWEN);
+  return wait_for_twint() && TW_STATUS == expected_ack;
+}
+
+static void polled_stop()
+{
+  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+  while (TWCR & _BV(TWSTO))
+  {
+  }
+}
+
+bool i2c_probe(uint8_t address)
+{
+  i2c_async_flush();
+
+  bool found = polled_start((address << 1) | TW_WRITE, TW_MT_SLA_ACK);
+  polled_stop();
+  return found;
+}
+
+bool i2c_read_registers(uint8_t address, uint8_t reg, uint8_t *data, uint8_t length)
+{
+  i2c_async_flush();
+
+  bool ok = polled_start((address << 1) | TW_WRITE, TW_MT_SLA_ACK);
+  if (ok)
+  {
+    TWDR = reg;
+    TWCR = _BV(TWINT) | _BV(TWEN);
+    ok = wait_for_twint() && TW_STATUS == TW_MT_DATA_ACK;
+  }
+  if (ok)
+  {
+    ok = polled_start((address << 1) | TW_READ, TW_MR_SLA_ACK);
+  }
+  for (uint8_t i = 0; ok && i < length; i++)
+  {
+    // every byte but the last is acknowledged
+    TWCR = _BV(TWINT) | _BV(TWEN) | (i + 1 < length ? _BV(TWEA) : 0);
+    ok = wait_for_twint();
+    data[i] = TWDR;
+  }
+  polled_stop();
+
+  if (!ok)
+  {
+    errors++;
+  }
+  return ok;
+}
@@ -0,0 +1,61 @@
+/*
+*Overview: Implementation of the rolling latency window.
+*/
+
+#include "latency_window.h"
+
+LatencyWindow::LatencyWindow()
+{
+  for (uint8_t i = 0; i < SIZE; i++)
+  {
+    samples[i] = 0;
+  }
+  next = 0;
+  filled = 0;
+  total = 0;
+}
+
+void LatencyWindow::add(unsigned long ms)
+{
+  samples[next] = ms > 0xFFFF ? 0xFFFF : ms;
+  next = (next + 1) & (SIZE - 1);
+  if (filled < SIZE)
+  {
+    filled++;
+  }
+  total++;
+}
+
+uint16_t LatencyWindow::percentile(uint8_t p) const
+{
+  if (filled == 0)
+  {
+    return 0;
+  }
+
+  // insertion sort of a copy, until the ring is full the measurements are its first entries
+  uint16_t sorted[SIZE];
+  for (uint8_t i = 0; i < filled; i++)
+  {
+    uint16_t value = samples[i];
+    uint8_t j = i;
+    while (j > 0 && sorted[j - 1] > value)
+    {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+
+  // the smallest value with at least p% of the window at or below it
+  uint16_t rank = ((uint16_t)p * filled + 99) / 100;
+  if (rank == 0)
+  {
+    rank = 1;
+  }
+  if (rank > filled)
+  {
+    rank = filled;
+  }
+  return sorted[rank - 1];
+}
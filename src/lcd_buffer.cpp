@@ -0,0 +1,191 @@
+/*
+*Overview: Implementation of the LCD shadow framebuffer.
+*/
+
+#include <string.h>
+
+#include "lcd_buffer.h"
+
+/* Marks the display address as unknown, so the next write always moves it first */
+static const uint8_t ADDRESS_UNKNOWN = 0xFF;
+
+LcdBuffer::LcdBuffer(HalDisplay &display) : display(display)
+{
+  memset(frame, ' ', sizeof(frame));
+  memset(shown, ' ', sizeof(shown));
+  col = 0;
+  row = 0;
+  cursor_on = false;
+  display_col = ADDRESS_UNKNOWN;
+  display_row = ADDRESS_UNKNOWN;
+  display_cursor_on = false;
+}
+
+void LcdBuffer::begin()
+{
+  display.begin(COLS, ROWS);
+  display.clear();
+  display.noCursor();
+
+  memset(frame, ' ', sizeof(frame));
+  memset(shown, ' ', sizeof(shown));
+  col = 0;
+  row = 0;
+  cursor_on = false;
+  display_col = 0;
+  display_row = 0;
+  display_cursor_on = false;
+}
+
+void LcdBuffer::clear()
+{
+  memset(frame, ' ', sizeof(frame));
+  col = 0;
+  row = 0;
+}
+
+void LcdBuffer::setCursor(uint8_t new_col, uint8_t new_row)
+{
+  col = new_col;
+  row = new_row < ROWS ? new_row : ROWS - 1;
+}
+
+void LcdBuffer::cursor()
+{
+  cursor_on = true;
+}
+
+void LcdBuffer::noCursor()
+{
+  cursor_on = false;
+}
+
+void LcdBuffer::put(char c)
+{
+  // characters past the right edge would land in the hidden part of the LCD memory, so they are dropped
+  if (col < COLS)
+  {
+    frame[row][col] = c;
+  }
+  if (col < 0xFF)
+  {
+    col++;
+  }
+}
+
+size_t LcdBuffer::print(const __FlashStringHelper *str)
+{
+  const char *p = reinterpret_cast<const char *>(str);
+  size_t n = 0;
+  for (char c = pgm_read_byte(p); c != '\0'; c = pgm_read_byte(++p))
+  {
+    put(c);
+    n++;
+  }
+  return n;
+}
+
+size_t LcdBuffer::print(const char *str)
+{
+  size_t n = 0;
+  for (; str[n] != '\0'; n++)
+  {
+    put(str[n]);
+  }
+  return n;
+}
+
+size_t LcdBuffer::print(char c)
+{
+  put(c);
+  return 1;
+}
+
+size_t LcdBuffer::print(int value)
+{
+  char digits[6];
+  uint8_t count = 0;
+  size_t n = 0;
+
+  unsigned int magnitude = value;
+  if (value < 0)
+  {
+    put('-');
+    n++;
+    magnitude = -(unsigned int)value;
+  }
+
+  do
+  {
+    digits[count++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+
+  while (count > 0)
+  {
+    put(digits[--count]);
+    n++;
+  }
+  return n;
+}
+
+uint8_t LcdBuffer::flush()
+{
+  uint8_t sent = 0;
+
+  for (uint8_t r = 0; r < ROWS; r++)
+  {
+    for (uint8_t c = 0; c < COLS; c++)
+    {
+      if (frame[r][c] == shown[r][c])
+      {
+        continue;
+      }
+
+      // the rest is sent on a later pass if the display queue is full
+      if (!display.ready())
+      {
+        return sent;
+      }
+
+      // the display moves one cell to the right after each character, so runs of changes need a single move
+      if (display_row != r || display_col != c)
+      {
+        display.setCursor(c, r);
+      }
+      display.write(frame[r][c]);
+      shown[r][c] = frame[r][c];
+      display_row = r;
+      display_col = c + 1;
+      sent++;
+    }
+  }
+
+  if (!display.ready())
+  {
+    return sent;
+  }
+
+  if (cursor_on != display_cursor_on)
+  {
+    if (cursor_on)
+    {
+      display.cursor();
+    }
+    else
+    {
+      display.noCursor();
+    }
+    display_cursor_on = cursor_on;
+  }
+
+  // the visible cursor has to sit at the drawing position
+  if (cursor_on && (display_row != row || display_col != col))
+  {
+    display.setCursor(col, row);
+    display_row = row;
+    display_col = col;
+  }
+
+  return sent;
+}
@@ -0,0 +1,174 @@
+/*
+*Overview: Implementation of the loop() profiler, empty unless LOOP_PROFILE is defined.
+*/
+
+#include "loop_profile.h"
+
+#ifdef LOOP_PROFILE
+
+LoopProfile loop_profile;
+
+#ifdef ARDUINO
+// the statistics of every stage are kept for the whole run, this much of the 2KB goes to them in [env:uno_profile]
+#define LOOP_PROFILE_RAM_BUDGET 384
+static_assert(sizeof(LoopProfile) <= LOOP_PROFILE_RAM_BUDGET, "the loop() profile is too large for the RAM of the Uno");
+#endif
+
+//+ Name of a stage for the table
+static const __FlashStringHelper *stage_name(uint8_t stage)
+{
+  switch (stage)
+  {
+  case STAGE_CLOCK:
+    return F("clock");
+  case STAGE_BUTTONS:
+    return F("buttons");
+  case STAGE_JOBS:
+    return F("jobs");
+  case STAGE_MENU:
+    return F("menu");
+  case STAGE_DISPLAY:
+    return F("display");
+  case STAGE_SLEEP:
+    return F("sleep");
+  default:
+    return F("pass");
+  }
+}
+
+void LoopProfile::begin()
+{
+  hal_cycles_begin();
+
+  // two timestamps back to back cost what every measurement has on top
+  uint32_t first = hal_cycles();
+  overhead = hal_cycles() - first;
+
+  reset();
+}
+
+void LoopProfile::reset()
+{
+  for (uint8_t i = 0; i < PROFILE_STAGES; i++)
+  {
+    Stats &entry = stats[i];
+    entry.count = 0;
+    entry.min = 0xFFFFFFFF;
+    entry.max = 0;
+    entry.sum = 0;
+    for (uint8_t bucket = 0; bucket < BUCKETS; bucket++)
+    {
+      entry.histogram[bucket] = 0;
+    }
+  }
+  skip_pass = true;
+}
+
+void LoopProfile::record(uint8_t stage, uint32_t cycles)
+{
+  cycles = cycles > overhead ? cycles - overhead : 0;
+
+  Stats &entry = stats[stage];
+  entry.count++;
+  entry.sum += cycles;
+  if (cycles < entry.min)
+  {
+    entry.min = cycles;
+  }
+  if (cycles > entry.max)
+  {
+    entry.max = cycles;
+  }
+
+  // the bucket is the position of the highest set bit, counted from FIRST_BUCKET
+  uint8_t bucket = 0;
+  cycles >>= FIRST_BUCKET;
+  while (cycles > 1 && bucket < BUCKETS - 1)
+  {
+    cycles >>= 1;
+    bucket++;
+  }
+  if (entry.histogram[bucket] != 0xFFFF)
+  {
+    entry.histogram[bucket]++;
+  }
+}
+
+void LoopProfile::start()
+{
+  uint32_t now = hal_cycles();
+
+  if (!skip_pass)
+  {
+    record(STAGE_PASS, now - pass_start);
+  }
+  skip_pass = false;
+
+  pass_start = now;
+  stage_start = now;
+}
+
+void LoopProfile::stage(uint8_t stage)
+{
+  uint32_t now = hal_cycles();
+
+  record(stage, now - stage_start);
+  stage_start = now;
+}
+
+bool LoopProfile::print_line(HalSerial &serial, uint8_t line)
+{
+  if (line > PROFILE_STAGES)
+  {
+    return false;
+  }
+  skip_pass = true;
+
+  if (line == 0)
+  {
+    serial.println(F("stage count min mean max (cycles), histogram from bucket n (2^n cycles)"));
+    return true;
+  }
+
+  uint8_t stage = line - 1;
+  const Stats &entry = stats[stage];
+
+  serial.print(stage_name(stage));
+  serial.print(F(" "));
+  serial.print((long)entry.count);
+  if (entry.count == 0)
+  {
+    serial.println();
+    return true;
+  }
+  serial.print(F(" "));
+  serial.print((long)entry.min);
+  serial.print(F(" "));
+  serial.print((long)(entry.sum / entry.count));
+  serial.print(F(" "));
+  serial.print((long)entry.max);
+
+  // only the buckets between the first and the last one used
+  uint8_t first = 0;
+  uint8_t last = BUCKETS - 1;
+  while (entry.histogram[first] == 0)
+  {
+    first++;
+  }
+  while (entry.histogram[last] == 0)
+  {
+    last--;
+  }
+  serial.print(F(" h"));
+  serial.print((long)(first + FIRST_BUCKET));
+  serial.print(F(":"));
+  for (uint8_t bucket = first; bucket <= last; bucket++)
+  {
+    serial.print(bucket == first ? F("") : F(","));
+    serial.print((long)entry.histogram[bucket]);
+  }
+  serial.println();
+  return true;
+}
+
+#endif
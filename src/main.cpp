@@ -30,16 +30,23 @@ SOFTWARE.
 
 */
 
-#include <Wire.h>
-#include <LiquidCrystal_I2C.h>
-#include <Bounce2.h>
-#include <RTClib.h>
-#include <SPI.h>
-#include <TimeLib.h>
-#include <TimeAlarms.h>
-#include <EEPROM.h>
+#include <stdlib.h>
 #include <string.h>
-#include <Arduino.h>
+
+#include "hal.h"
+#include "alarm_table.h"
+#include "button_input.h"
+#include "command_line.h"
+#include "config.h"
+#include "ee_journal.h"
+#include "latency_window.h"
+#include "lcd_buffer.h"
+#include "loop_profile.h"
+#include "menu_table.h"
+#include "scheduler.h"
+#include "soft_clock.h"
+#include "text_format.h"
+#include "volt_fixed.h"
 
 /* Input pin setup for the buttons*/
 const int IN_up_btn_pin = 3;
@@ -49,13 +56,24 @@ const int IN_right_btn_pin = 5;
 const int IN_sel_btn_pin = 7;
 const int IN_back_btn_pin = 6;
 
-/* Pin setup for the I2C LCD display */
-// Setting the address of the LCD diplay as 0x27
-LiquidCrystal_I2C lcd(0x27, 2, 1, 0, 4, 5, 6, 7, 3, POSITIVE);
+/* The I2C LCD display (its address is set in the HAL) */
+HalDisplay display;
+
+// The screens draw into this framebuffer, only the changed cells are sent to the display
+LcdBuffer lcd(display);
 
 // the number of the LED pin so it can be dimmed through PWM
 const int OUT_led_pin = 11;
 
+/* The backlight level of the idle screen while the arduino powers down between the RTC ticks. The PWM that dims it
+stops in power down, so only 255 (fully on, the idle screen stays readable) and 0 (off, it draws no current) hold;
+build with -DSLEEP_BACKLIGHT=0 to switch it off */
+#ifndef SLEEP_BACKLIGHT
+#define SLEEP_BACKLIGHT 255
+#endif
+
+static_assert(SLEEP_BACKLIGHT == 0 || SLEEP_BACKLIGHT == 255, "the backlight PWM stops in power down");
+
 /* Pin setup for the voltage measurement */
 int IN_voltage_pin = A0;
 
@@ -82,6 +100,11 @@ int reset_volt_alarm_state = 0;
 int view_datetime_state = 0;
 int set_datetime_state = 0;
 
+// diagnostics state variables
+int view_diagnostics_state = 0;
+int diagnostics_page = 0;
+uint8_t diagnostics_shown = 0;
+
 /* STATE VARIABLES FOR THE MAIN FSM */
 // state of the FSM
 int state = 0;
@@ -101,13 +124,24 @@ int *ptimeon = &time_on_temp[0];
 int *ptimeoff = &time_off_temp[0];
 
 // temporary time variables shown on screen when setting and resetting (used inside functions and then cleared)
-String time_on_temp_s = "0000";
-String time_off_temp_s = "0000";
+char time_on_temp_s[TIME_TEXT_SIZE] = "0000";
+char time_off_temp_s[TIME_TEXT_SIZE] = "0000";
+
+// the weekday mask being set (used inside functions and then cleared)
+uint8_t time_days_temp = ALL_DAYS;
+
+// whether the alarm view shows the days of the alarm instead of the next switching event
+bool view_alarm_days = false;
+
+// the alarms themselves are kept in config (stored in "RAM")
 
-// persistent string time variables (stored in "RAM")
-String ON_times_s[10] = {"0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000"};
-String OFF_times_s[10] = {"0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000"};
-bool active_alarms[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+// the active alarms compiled into the schedule of a day, rebuilt whenever an alarm is saved or deleted and every day
+AlarmTable alarm_table;
+
+// the day the schedule was compiled for (days since 1 Jan 2000), NO_SCHEDULE_DAY has it compiled on the next check
+#define NO_SCHEDULE_DAY 0xFFFF
+#define SECONDS_PER_DAY 86400UL
+uint16_t schedule_day = NO_SCHEDULE_DAY;
 
 // EEPROM variables stored elsewhere
 /* 
@@ -130,19 +164,13 @@ int *pvolton = &volt_on_temp[0];
 int *pvoltoff = &volt_off_temp[0];
 
 // temporary string voltage variables (used inside functions and then cleared)
-String volt_on_temp_s = "00.0";
-String volt_off_temp_s = "00.0";
-
-// persistent string voltage variables (stored in "RAM")
-String ON_volt_s = "00.0";
-String OFF_volt_s = "00.0";
+char volt_on_temp_s[VOLT_TEXT_SIZE] = "00.0";
+char volt_off_temp_s[VOLT_TEXT_SIZE] = "00.0";
 
-// displayed integer voltage variables (stored in "RAM")
-int ON_volt = 0;
-int OFF_volt = 0;
-
-// persistant voltage alarm flag (stored in "RAM")
-bool volt_active = 0;
+// the thresholds themselves are kept in config, these are the same thresholds as raw ADC counts, worked out
+// whenever they are saved
+int16_t ON_volt_counts = 0;
+int16_t OFF_volt_counts = 0;
 
 // measured volatge value (stored in "RAM")
 int voltage = 0;
@@ -181,24 +209,66 @@ uint8_t newsec = 0;
 
 ? START EEPROM VARIABLES
 */
-// the EEPROM addresses for the stored value arrays
-int ee_on_address = 0;
-int ee_off_address = 60;
-int ee_set_address = 120;
-
-int ee_volts_on_address = 140;
-int ee_volts_off_address = 150;
-int ee_volts_set_address = 160;
-
-int read_eeprom_st = 0;
-
-char ee_on[10][5] = {"0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000"};
-char ee_off[10][5] = {"0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000", "0000"};
-bool ee_active[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-int ee_volts_on[] = {0, 0, 0, 0};
-int ee_volts_off[] = {0, 0, 0, 0};
-bool ee_volts_active = 0;
+// the non-volatile storage
+HalStorage storage;
+
+// the settings, the only copy of them in RAM
+Config config = {CONFIG_VERSION, {0}, {0}, {0}, {0}, 0, 0, 0, {0}};
+
+// the settings are kept as a log of records spread over the whole EEPROM (see ee_journal.h)
+#define CONFIG_LOG_SIZE 1024
+EeJournal config_log(storage, 0, CONFIG_LOG_SIZE);
+
+#ifdef ARDUINO
+static_assert(CONFIG_LOG_SIZE <= E2END + 1, "the EEPROM log is larger than the EEPROM");
+#endif
+
+// a compaction copies a record of every key into the other bank, which has to leave at least this many slots for the
+// writes up to the next one (40 time alarms leave exactly these)
+#define LOG_FREE_SLOTS 16
+static_assert(CONFIG_KEYS <= EeJournal::bank_slots(CONFIG_LOG_SIZE) - LOG_FREE_SLOTS,
+              "TIME_ALARM_COUNT is too high for the EEPROM log, it would be compacting every few writes");
+
+#ifdef ARDUINO
+// what grows with TIME_ALARM_COUNT (the settings, the alarm table and the index of the log) gets this much of the 2KB
+#define ALARM_RAM_BUDGET 640
+static_assert(sizeof(Config) + sizeof(AlarmTable) + sizeof(EeJournal) <= ALARM_RAM_BUDGET,
+              "TIME_ALARM_COUNT is too high for the RAM of the Uno");
+#endif
+
+
+// set in the first data word of a record when the alarm is active
+#define ALARM_ACTIVE_FLAG 0x8000
+
+// a minute of the day takes the low 11 bits of a data word, the days a time alarm is skipped on go in the bits above
+// (Sunday to Wednesday with the ON minute, Thursday to Saturday with the OFF minute), so the records from before the
+// weekday masks read back as every day
+#define ALARM_MINUTE_BITS 11
+#define ALARM_MINUTE_MASK 0x07FF
+
+// a holiday record holds 3 calendar days of 10 bits each, from the lowest bits up, the slots not used are all ones
+#define HOLIDAY_BITS 10
+#define HOLIDAY_NONE 0x3FF
+static_assert(HOLIDAY_DAYS <= HOLIDAY_NONE && HOLIDAYS_PER_RECORD * HOLIDAY_BITS <= 8 * JOURNAL_DATA_SIZE,
+              "the holidays do not fit their records");
+
+// the settings changed in RAM since they were last written to the log, one bit per record key
+uint8_t dirty_settings[BIT_ARRAY_BYTES(CONFIG_KEYS)];
+
+// the fixed addresses the settings were stored at before the log (only read to carry them over), which held 10 alarms
+#define LEGACY_ALARM_COUNT 10
+#define LEGACY_ON_ADDRESS 0
+#define LEGACY_OFF_ADDRESS 60
+#define LEGACY_SET_ADDRESS 120
+#define LEGACY_VOLTS_ON_ADDRESS 140
+#define LEGACY_VOLTS_OFF_ADDRESS 150
+#define LEGACY_VOLTS_SET_ADDRESS 160
+
+// the keys of a version 1 log for the time alarms from the 11th on, which came right after the version key until 12
+// records of holiday bits (a bit for every calendar day, 4 bytes to a record) took keys 12 to 23 for a while
+#define V1_EXTRA_ALARM_KEY 12
+#define V1_HOLIDAY_KEY 12
+#define V1_HOLIDAY_RECORDS 12
 /* 
 ? END EEPROM VARIABLES
 
@@ -224,12 +294,19 @@ int *ptrCurPos = &cursorPos;
 
 ? START BUTTON INPUT DEFINITIONS
 */
-Bounce up = Bounce();
-Bounce dn = Bounce();
-Bounce lt = Bounce();
-Bounce rt = Bounce();
-Bounce ok = Bounce();
-Bounce bc = Bounce();
+// The button pins, all on PORTD
+const uint8_t BUTTON_PINS = (1 << IN_up_btn_pin) | (1 << IN_down_btn_pin) | (1 << IN_left_btn_pin) |
+                            (1 << IN_right_btn_pin) | (1 << IN_sel_btn_pin) | (1 << IN_back_btn_pin);
+
+// The presses and releases of all the buttons (debounced by the HAL), one taken per pass of loop()
+ButtonInput buttons;
+
+InputButton up(buttons, IN_up_btn_pin);
+InputButton dn(buttons, IN_down_btn_pin);
+InputButton lt(buttons, IN_left_btn_pin);
+InputButton rt(buttons, IN_right_btn_pin);
+InputButton ok(buttons, IN_sel_btn_pin);
+InputButton bc(buttons, IN_back_btn_pin);
 /* 
 ? END BUTTON INPUT DEFINITIONS
 
@@ -242,13 +319,120 @@ Bounce bc = Bounce();
 ? START RTC DECLARATION
 */
 // Setting up the RTC for use
-RTC_DS1307 rtc;
-int prev_sec = 0;
+HalClock rtc;
+
+// The clock that the firmware reads, kept in step with the RTC once a minute
+SoftClock sys_clock;
+int prev_sec = -1;
+int prev_min = -1;
 int al_num = 0;
 /* 
 ? END RTC DECLARATIONS
 
 
+*/
+
+/* 
+
+
+? START SERIAL DECLARATION
+*/
+HalSerial serial;
+/* 
+? END SERIAL DECLARATION
+
+
+*/
+
+/* 
+
+
+? START SCHEDULER DECLARATION
+*/
+// Jobs that run from loop() without blocking it
+Scheduler scheduler;
+
+// How often the voltage is sampled and the voltage alarm is checked (in milliseconds)
+const unsigned long VOLT_SAMPLE_PERIOD = 5000;
+/* 
+? END SCHEDULER DECLARATION
+
+
+*/
+
+/* 
+
+
+? START POWER DECLARATION
+*/
+// The 1Hz square wave output of the RTC is wired to A1, its ticks wake the arduino from power down
+const uint8_t IN_sqw_pin = A1;
+
+// Cleared when a power down runs into the watchdog (the ticks are not coming), the arduino then stays awake
+bool sqw_ticking = true;
+
+// Time spent powered down since the last report and the awake time per second it came to (in milliseconds)
+unsigned long asleep_ms = 0;
+unsigned long power_report_ms = 0;
+uint16_t awake_ms_per_s = 1000;
+/* 
+? END POWER DECLARATION
+
+
+*/
+
+/* 
+
+
+? START LATENCY DECLARATION
+*/
+// From a button press to the first byte sent to the LCD for it, and from the voltage crossing a threshold to the relay
+// switching for it (in milliseconds)
+LatencyWindow button_latency;
+LatencyWindow relay_latency;
+
+// Set while the averaged voltage is past a threshold that the relay has not acted on yet, and since when
+bool volt_crossed = false;
+unsigned long volt_crossed_ms = 0;
+/* 
+? END LATENCY DECLARATION
+
+
+*/
+
+/* 
+
+
+? START CONSOLE DECLARATION
+*/
+// The lines received over serial, see run_console_command() for the commands
+CommandLine console;
+
+/* The replies of the console, printed a line per pass of loop() */
+const uint8_t LIST_NONE = 0;
+const uint8_t LIST_REPLY = 1; // the single line in console_reply
+const uint8_t LIST_HELP = 2;
+const uint8_t LIST_ALARMS = 3;
+const uint8_t LIST_VOLT = 4;
+const uint8_t LIST_TIME = 5;
+const uint8_t LIST_STATE = 6;
+const uint8_t LIST_STATS = 7;
+const uint8_t LIST_PROFILE = 8;
+const uint8_t LIST_HOLIDAYS = 9;
+
+uint8_t console_listing = LIST_NONE;
+uint8_t console_line = 0;
+const __FlashStringHelper *console_reply = F("ok");
+
+// A line is only printed once this much of the transmit buffer (64 bytes on the Uno) is free, so printing never waits
+const int CONSOLE_LINE_ROOM = 48;
+
+// When the last character came in, the arduino stays awake for T_SLEEP after it
+unsigned long console_activity_ms = 0;
+/* 
+? END CONSOLE DECLARATION
+
+
 */
 
 /* FUNCTION DECLARATIONS */
@@ -264,37 +448,28 @@ int al_num = 0;
 ????????????????????????????
 */
 
-//+ Handles button presses and maps it to state transitions
-int handle_button_inputs(int up_st, int dn_st, int lt_st, int rt_st, int ok_st, int bc_st, int curr_st)
+//+ Prints a time given in minutes since midnight in the format HHMM
+void print_hhmm(uint16_t minute)
 {
-  int next_state = curr_st;
+  char text[TIME_TEXT_SIZE];
+  format_uint(text, minute_to_hhmm(minute), 4);
+  lcd.print(text);
+}
 
-  if (up.rose())
-  {
-    next_state = up_st;
-  }
-  else if (dn.rose())
-  {
-    next_state = dn_st;
-  }
-  else if (lt.rose())
-  {
-    next_state = lt_st;
-  }
-  else if (rt.rose())
-  {
-    next_state = rt_st;
-  }
-  else if (ok.rose())
-  {
-    next_state = ok_st;
-  }
-  else if (bc.rose())
-  {
-    next_state = bc_st;
-  }
+//+ Prints a voltage in decivolts as XX.Y
+void print_decivolts(uint16_t decivolts)
+{
+  char text[VOLT_TEXT_SIZE];
+  format_decivolts(text, decivolts);
+  lcd.print(text);
+}
 
-  return next_state;
+//+ Prints a weekday mask as SMTWTFS
+void print_days(uint8_t days)
+{
+  char text[DAYS_TEXT_SIZE];
+  format_days(text, days);
+  lcd.print(text);
 }
 
 //+ Reset voltage temporary variables
@@ -303,8 +478,8 @@ void reset_temp_volt_variables()
   // calculating the length by dividing the size of the array by one of its units
   int length_of_volt_temps = sizeof(volt_on_temp) / sizeof(volt_on_temp[0]);
 
-  volt_off_temp_s = "00.0";
-  volt_on_temp_s = "00.0";
+  copy_text(volt_off_temp_s, "00.0", VOLT_TEXT_SIZE);
+  copy_text(volt_on_temp_s, "00.0", VOLT_TEXT_SIZE);
 
   for (int i = 0; i < length_of_volt_temps; i++)
   {
@@ -319,8 +494,9 @@ void reset_temp_time_variables()
   // calculating the length by dividing the size of the array by one of its units
   int length_of_time_temps = sizeof(time_on_temp) / sizeof(time_on_temp[0]);
 
-  time_off_temp_s = "0000";
-  time_on_temp_s = "0000";
+  copy_text(time_off_temp_s, "0000", TIME_TEXT_SIZE);
+  copy_text(time_on_temp_s, "0000", TIME_TEXT_SIZE);
+  time_days_temp = ALL_DAYS;
 
   for (int i = 0; i < length_of_time_temps; i++)
   {
@@ -394,7 +570,7 @@ int handle_time_entry(int cursorPos, int *ptime)
     }
     *(ptime + cursorPos) = currentDigit;
     lcd.setCursor(cursorPos, 1);
-    lcd.print(String(currentDigit));
+    lcd.print(digit_char(currentDigit));
     lcd.setCursor(cursorPos, 1);
     lcd.cursor();
   }
@@ -406,7 +582,7 @@ int handle_time_entry(int cursorPos, int *ptime)
     }
     *(ptime + cursorPos) = currentDigit;
     lcd.setCursor(cursorPos, 1);
-    lcd.print(String(currentDigit));
+    lcd.print(digit_char(currentDigit));
     lcd.setCursor(cursorPos, 1);
     lcd.cursor();
   }
@@ -437,336 +613,626 @@ int handle_time_entry(int cursorPos, int *ptime)
   return cursorPos;
 }
 
-//+ Resets the time arrays at a given index and stores the result in EEPROM and RAM
-void reset_time(int index)
+//+ Compiles the active time alarms into the schedule of the date of now. An alarm runs on the days of its weekday mask
+// that are not holidays, and the part of an overnight window after midnight belongs to the day it started on.
+void compile_alarm_schedule(const HalDateTime &now)
 {
-  String zero = "0000";
-  // Setting the live variables
-  ON_times_s[index] = zero;
-  OFF_times_s[index] = zero;
-  active_alarms[index] = false;
-
-  // Setting the EEPROM stored variables
-  zero.toCharArray(ee_on[index], 5);
-  zero.toCharArray(ee_off[index], 5);
-  ee_active[index] = false;
+  uint32_t seconds = now.seconds();
+  HalDateTime yesterday = HalDateTime::from_seconds(seconds >= SECONDS_PER_DAY ? seconds - SECONDS_PER_DAY : seconds);
 
-  // Pushing to EEPROM
-  EEPROM.put(ee_on_address, ee_on);
-  EEPROM.put(ee_off_address, ee_off);
-  EEPROM.put(ee_set_address, ee_active);
+  // the bit of the weekday masks for each of the two days, none on a holiday
+  uint8_t today_bit = is_holiday(config, now.calendar_day()) ? 0 : 1 << now.dayOfTheWeek();
+  uint8_t yesterday_bit = is_holiday(config, yesterday.calendar_day()) ? 0 : 1 << yesterday.dayOfTheWeek();
 
-  reset_temp_time_variables();
+  alarm_table.clear();
+  for (uint8_t i = 0; i < TIME_ALARM_COUNT; i++)
+  {
+    if (alarm_is_active(config, i))
+    {
+      alarm_table.add(config.alarm_on[i], config.alarm_off[i], config.alarm_days[i] & today_bit,
+                      config.alarm_days[i] & yesterday_bit);
+    }
+  }
+  schedule_day = seconds / SECONDS_PER_DAY;
 }
 
-//+ Handles the entry of voltage values
-int handle_volt_entry(int cursorPos, int *pvolt)
+//+ Checks whether a time alarm is triggered and handles the output
+// Runs on every minute tick and after the alarms are rebuilt. The relay is switched when the state the schedule wants
+// for this minute changes, so a window that was entered during a stall, a reboot or a clock change is put right at
+// once, while the voltage alarm can still override it until the next change.
+void handle_time_alarms()
 {
-  /* Voltage is entered as an array of 4 integers in the format
-    as XX.Y where XX is the voltage and Y is the hundreds of millivolts
-
-   e.g. 11.5 (11.5V) is represented as 11.5
-
-   NOTE: Only the 0,1,and 3 indices are used and the index 2 is left blank intentionally. 
-   
-  */
-
-  int periodPos = 2;
-  int maxPos = 3;
-  int minPos = 0;
-  int currentDigit = *(pvolt + cursorPos);
+  // defining the time
+  HalDateTime now = sys_clock.now();
 
-  if (up.rose())
+  // the schedule covers one day, it is compiled again once the date changes
+  if (now.seconds() / SECONDS_PER_DAY != schedule_day)
   {
-    if (currentDigit < 9 && cursorPos != periodPos)
-    {
-
-      currentDigit += 1;
-      *(pvolt + cursorPos) = currentDigit;
-      lcd.setCursor(cursorPos, 1);
-      lcd.print(String(currentDigit));
-      lcd.setCursor(cursorPos, 1);
-      lcd.cursor();
-    }
+    compile_alarm_schedule(now);
   }
-  if (dn.rose())
+
+  bool relay_on = false;
+  if (alarm_table.check(now.hour() * 60 + now.minute(), relay_on))
   {
-    if (currentDigit > 0 && cursorPos != periodPos)
-    {
-      currentDigit -= 1;
-      *(pvolt + cursorPos) = currentDigit;
-      lcd.setCursor(cursorPos, 1);
-      lcd.print(String(currentDigit));
-      lcd.setCursor(cursorPos, 1);
-      lcd.cursor();
-    }
+    // SWITCH THE RELAY ON OR OFF
+    hal_gpio_write(OUT_relay_pin, relay_on ? HIGH : LOW);
   }
-  if (lt.rose())
-  {
-    if (cursorPos > minPos)
-    {
-      cursorPos -= 1;
+}
 
-      // this is done so that the cursor never reaches period index
-      if (cursorPos == periodPos)
-      {
-        cursorPos -= 1;
-      }
-    }
-  }
-  if (rt.rose())
+//+ Compiles the time alarms again after a change and switches the relay if that changed the state they want now, so
+// saving an alarm or a holiday that leaves the current minute alone does not undo what the voltage alarm switched
+void rebuild_alarm_table()
+{
+  schedule_day = NO_SCHEDULE_DAY;
+  handle_time_alarms();
+}
+
+//+ Packs two 16-bit words into the data of a log record
+void pack_record(uint8_t *data, uint16_t first, uint16_t second)
+{
+  data[0] = first & 0xFF;
+  data[1] = first >> 8;
+  data[2] = second & 0xFF;
+  data[3] = second >> 8;
+}
+
+//+ Writes time alarm index to the EEPROM log as its ON and OFF minutes of the day and the days it is skipped on
+void save_time_alarm(int index)
+{
+  uint8_t data[JOURNAL_DATA_SIZE];
+  uint16_t skipped = ~config.alarm_days[index] & ALL_DAYS;
+  pack_record(data,
+              config.alarm_on[index] | (skipped & 0x0F) << ALARM_MINUTE_BITS |
+                  (alarm_is_active(config, index) ? ALARM_ACTIVE_FLAG : 0),
+              config.alarm_off[index] | (skipped >> 4) << ALARM_MINUTE_BITS);
+  config_log.write(time_alarm_key(index), data);
+}
+
+//+ Writes record number record of the holidays to the EEPROM log, the dates from number 3 * record on in calendar order
+void save_holidays(uint8_t record)
+{
+  uint32_t packed = 0xFFFFFFFF;
+  uint8_t first = record * HOLIDAYS_PER_RECORD;
+  uint8_t found = 0;
+  for (uint16_t day = 0; day < HOLIDAY_DAYS && found < first + HOLIDAYS_PER_RECORD; day++)
   {
-    if (cursorPos < maxPos)
+    if (is_holiday(config, day))
     {
-      cursorPos += 1;
-
-      // this is done so that the cursor never reaches period index
-      if (cursorPos == periodPos)
+      if (found >= first)
       {
-        cursorPos += 1;
+        uint8_t shift = (found - first) * HOLIDAY_BITS;
+        packed = (packed & ~((uint32_t)HOLIDAY_NONE << shift)) | (uint32_t)day << shift;
       }
+      found++;
     }
   }
-  if (ok.rose())
+
+  uint8_t data[JOURNAL_DATA_SIZE];
+  pack_record(data, packed & 0xFFFF, packed >> 16);
+  config_log.write(HOLIDAY_KEY + record, data);
+}
+
+//+ Number of dates marked as holidays
+uint8_t holiday_count()
+{
+  uint8_t count = 0;
+  for (uint16_t day = 0; day < HOLIDAY_DAYS; day++)
   {
-    cursorPos = 0;
-    lcd.setCursor(cursorPos, 1);
-    lcd.noCursor();
+    count += is_holiday(config, day);
   }
-  return cursorPos;
+  return count;
 }
 
-//+ Handles the entry of date time values
-int handle_new_date_time_entry(int cursorPos, int *pnewdatetime)
+//+ Writes the voltage alarm to the EEPROM log as its ON and OFF thresholds (decivolts)
+void save_volt_alarm()
 {
-  /* New datetime is entered as an array of 16 integers in the format
-    as YYYY0MM0DD0HH0MM
-
-   
+  uint8_t data[JOURNAL_DATA_SIZE];
+  pack_record(data, config.volt_on | (config.volt_active ? ALARM_ACTIVE_FLAG : 0), config.volt_off);
+  config_log.write(VOLT_ALARM_KEY, data);
+}
 
-  // Note: the indices at position 4,7,10 and 13 are left blank intentionally   
-  */
+//+ Writes the version the records were written with
+void save_config_version()
+{
+  uint8_t data[JOURNAL_DATA_SIZE];
+  pack_record(data, config.version, 0);
+  config_log.write(CONFIG_VERSION_KEY, data);
+}
 
-  int maxPos = 15;
-  int minPos = 0;
-  int currentDigit = *(pnewdatetime + cursorPos);
+//+ Marks a setting (a record key) as changed so that save_settings() writes it
+void mark_setting_dirty(uint8_t key)
+{
+  bit_set(dirty_settings, key, true);
+}
 
-  if (up.rose())
+//+ Writes a record for every changed setting only, the bytes that are the same as before are not rewritten
+void save_settings()
+{
+  for (uint8_t i = 0; i < TIME_ALARM_COUNT; i++)
   {
-    if (currentDigit < 9 && (cursorPos != 4 || cursorPos != 7 || cursorPos != 10 || cursorPos != 13))
+    if (bit_get(dirty_settings, time_alarm_key(i)))
     {
-      currentDigit += 1;
-      *(pnewdatetime + cursorPos) = currentDigit;
-      lcd.setCursor(cursorPos, 1);
-      lcd.print(String(currentDigit));
-      lcd.setCursor(cursorPos, 1);
-      lcd.cursor();
+      save_time_alarm(i);
     }
   }
-  if (dn.rose())
+  for (uint8_t record = 0; record < HOLIDAY_RECORDS; record++)
   {
-    if (currentDigit > 0 && (cursorPos != 4 || cursorPos != 7 || cursorPos != 10 || cursorPos != 13))
+    if (bit_get(dirty_settings, HOLIDAY_KEY + record))
     {
-      currentDigit -= 1;
-      *(pnewdatetime + cursorPos) = currentDigit;
-      lcd.setCursor(cursorPos, 1);
-      lcd.print(String(currentDigit));
-      lcd.setCursor(cursorPos, 1);
-      lcd.cursor();
+      save_holidays(record);
     }
   }
-  if (lt.rose())
+  if (bit_get(dirty_settings, VOLT_ALARM_KEY))
   {
-    if (cursorPos > minPos)
-    {
-      cursorPos -= 1;
+    save_volt_alarm();
+  }
+  if (bit_get(dirty_settings, CONFIG_VERSION_KEY))
+  {
+    save_config_version();
+  }
+  bit_clear_all(dirty_settings, sizeof(dirty_settings));
+}
 
-      // this is done so that the cursor never reaches period index
-      if (cursorPos == 4 || cursorPos == 7 || cursorPos == 10 || cursorPos == 13)
+//+ Reads the settings from the fixed addresses they were stored at before the log, returns false if they are not there
+bool load_legacy_settings()
+{
+  char read_ee_on[LEGACY_ALARM_COUNT][5];
+  char read_ee_off[LEGACY_ALARM_COUNT][5];
+  bool read_active[LEGACY_ALARM_COUNT];
+  int read_ee_volts_on[4];
+  int read_ee_volts_off[4];
+  bool read_volts_active;
+
+  storage.get(LEGACY_ON_ADDRESS, read_ee_on);
+  storage.get(LEGACY_OFF_ADDRESS, read_ee_off);
+  storage.get(LEGACY_SET_ADDRESS, read_active);
+  storage.get(LEGACY_VOLTS_ON_ADDRESS, read_ee_volts_on);
+  storage.get(LEGACY_VOLTS_OFF_ADDRESS, read_ee_volts_off);
+  storage.get(LEGACY_VOLTS_SET_ADDRESS, read_volts_active);
+
+  // a blank EEPROM (or anything else) is not taken for settings
+  for (size_t i = 0; i < LEGACY_ALARM_COUNT; i++)
+  {
+    if (read_ee_on[i][4] != '\0' || read_ee_off[i][4] != '\0')
+    {
+      return false;
+    }
+    for (size_t j = 0; j < 4; j++)
+    {
+      if (read_ee_on[i][j] < '0' || read_ee_on[i][j] > '9' || read_ee_off[i][j] < '0' || read_ee_off[i][j] > '9')
       {
-        cursorPos -= 1;
+        return false;
       }
     }
   }
-  if (rt.rose())
+  for (size_t j = 0; j < 4; j++)
   {
-    if (cursorPos < maxPos)
+    if (read_ee_volts_on[j] < 0 || read_ee_volts_on[j] > 9 || read_ee_volts_off[j] < 0 || read_ee_volts_off[j] > 9)
     {
-      cursorPos += 1;
-
-      // this is done so that the cursor never reaches period index
-      if (cursorPos == 4 || cursorPos == 7 || cursorPos == 10 || cursorPos == 13)
-      {
-        cursorPos += 1;
-      }
+      return false;
     }
   }
-  if (ok.rose())
+
+  for (uint8_t i = 0; i < LEGACY_ALARM_COUNT && i < TIME_ALARM_COUNT; i++)
   {
-    cursorPos = 0;
-    lcd.setCursor(cursorPos, 1);
-    lcd.noCursor();
+    config.alarm_on[i] = hhmm_to_minute(parse_digits(read_ee_on[i]));
+    config.alarm_off[i] = hhmm_to_minute(parse_digits(read_ee_off[i]));
+    set_alarm_active(config, i, read_active[i]);
   }
-  return cursorPos;
+
+  config.volt_on = read_ee_volts_on[0] * 100 + read_ee_volts_on[1] * 10 + read_ee_volts_on[3];
+  config.volt_off = read_ee_volts_off[0] * 100 + read_ee_volts_off[1] * 10 + read_ee_volts_off[3];
+  config.volt_active = read_volts_active;
+  return true;
 }
 
-//+ This function returns the measured voltage
-int measure_voltage()
+//+ Reads time alarm index from the newest record of key in the EEPROM log, if there is one
+void load_time_alarm(uint8_t index, uint8_t key)
 {
+  uint8_t data[JOURNAL_DATA_SIZE];
+  if (!config_log.read(key, data))
+  {
+    return;
+  }
 
-  int measured_value = 0;
-  int sum_of_samples = 0;
-  int valid_samples = 0;
-  int average_measured_value = 0;
-
-  float calculated_voltage = 0;
-  int formatted_voltage = 0;
+  uint16_t on = data[0] | (data[1] << 8);
+  uint16_t off = data[2] | (data[3] << 8);
+  config.alarm_on[index] = on & ALARM_MINUTE_MASK;
+  config.alarm_off[index] = off & ALARM_MINUTE_MASK;
+  set_alarm_active(config, index, on & ALARM_ACTIVE_FLAG);
 
-  float R_in = 3430.0;
-  float R_big = 8980.0;
+  uint8_t skipped = (on >> ALARM_MINUTE_BITS & 0x0F) | (off >> ALARM_MINUTE_BITS & 0x07) << 4;
+  config.alarm_days[index] = ~skipped & ALL_DAYS;
+}
 
-  // averaging the sampled voltages to smooth the sampling
-  for (int i = 0; i < 5; i++)
+//+ Reads the voltage alarm from the newest record of its key in the EEPROM log, if there is one
+void load_volt_alarm()
+{
+  uint8_t data[JOURNAL_DATA_SIZE];
+  if (!config_log.read(VOLT_ALARM_KEY, data))
   {
-    // read the value from pin
-    analogRead(IN_voltage_pin);
-
-    measured_value = analogRead(IN_voltage_pin);
-
-    if (measured_value != 0)
-    {
-      sum_of_samples += measured_value;
-      valid_samples++;
-    }
-    delayMicroseconds(200);
+    return;
   }
 
-  // calculating the average sampled value
-  average_measured_value = sum_of_samples / valid_samples;
-
-  // calculates the voltage from the measured analog value
-  // 5 is for the voltage reference of the arduino and 1023 is the 10-bit sample range
-  calculated_voltage = (average_measured_value * 5 * (R_big + R_in)) / (R_in * 1023);
-
-  // multiplies the calculated voltage by 1000 to get the first 3 digits
-  formatted_voltage = int(calculated_voltage * 10);
+  uint16_t on = data[0] | (data[1] << 8);
+  config.volt_on = on & ~ALARM_ACTIVE_FLAG;
+  config.volt_off = data[2] | (data[3] << 8);
+  config.volt_active = (on & ALARM_ACTIVE_FLAG) != 0;
+}
 
-  return formatted_voltage;
+//+ Returns true if a record of a version 1 log reads as a time alarm from before the weekday masks, two minutes of the
+// day and the active flag
+bool is_v1_alarm_record(const uint8_t *data)
+{
+  uint16_t on = data[0] | (data[1] << 8);
+  uint16_t off = data[2] | (data[3] << 8);
+  return (on & ~ALARM_ACTIVE_FLAG) < MINUTES_PER_DAY && off < MINUTES_PER_DAY;
 }
 
-//+ This function handles whats shown onscreen
-// View this code alongside the handle_states function for clarity
-void update_menu(int state)
+//+ Reads the settings of a log written with version 1, from before the holidays were saved as dates: its first 10
+// time alarms and the voltage alarm have the keys and records they have now, the rest is moved to the keys of now as
+// far as the keys of this build reach
+void load_v1_settings()
 {
-  switch (state)
-  {
+  uint8_t data[JOURNAL_DATA_SIZE];
 
-  case 0: // IDLE STATE
-    break;
+  for (uint8_t i = 0; i < LEGACY_ALARM_COUNT && i < TIME_ALARM_COUNT; i++)
+  {
+    load_time_alarm(i, i);
+  }
+  load_volt_alarm();
 
-  case 1: // HOME -> TIME_ALARMS_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(">Time alarms"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(" Voltage alarm"));
-    analogWrite(OUT_led_pin, 127); // Brighten the display
-    break;
+  // a log from while the holiday bits took keys 12 to 23 has a record there that does not read as an old alarm, or
+  // none at all but alarms after them
+  bool holiday_bits = false;
+  bool before = false;
+  bool after = false;
+  for (uint8_t key = V1_HOLIDAY_KEY; key < CONFIG_KEYS; key++)
+  {
+    if (!config_log.read(key, data))
+    {
+      continue;
+    }
+    if (key < V1_HOLIDAY_KEY + V1_HOLIDAY_RECORDS)
+    {
+      before = true;
+      holiday_bits = holiday_bits || !is_v1_alarm_record(data);
+    }
+    else
+    {
+      after = true;
+    }
+  }
+  holiday_bits = holiday_bits || (after && !before);
 
-  case 2: // HOME -> VOLT_ALARM_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(" Time alarms"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(">Voltage alarm"));
-    analogWrite(OUT_led_pin, 127); // Brighten the display
-    break;
+  uint8_t extra_key = holiday_bits ? V1_HOLIDAY_KEY + V1_HOLIDAY_RECORDS : V1_EXTRA_ALARM_KEY;
+  for (uint8_t i = LEGACY_ALARM_COUNT; i < TIME_ALARM_COUNT; i++)
+  {
+    load_time_alarm(i, extra_key + i - LEGACY_ALARM_COUNT);
+  }
 
-  case 3: // TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(">View timer(s)"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(" Set timer"));
-    break;
+  if (!holiday_bits)
+  {
+    return;
+  }
+  for (uint8_t record = 0; record < V1_HOLIDAY_RECORDS; record++)
+  {
+    if (config_log.read(V1_HOLIDAY_KEY + record, data))
+    {
+      for (uint8_t i = 0; i < JOURNAL_DATA_SIZE && record * JOURNAL_DATA_SIZE + i < (int)sizeof(config.holidays); i++)
+      {
+        config.holidays[record * JOURNAL_DATA_SIZE + i] = data[i];
+      }
+    }
+  }
 
-  case 4: // VOLT_ALARM_MENU -> VIEW_VOLT_ALARM_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(">View volt alarm"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(" Set volt alarm"));
-    break;
+  // the bits had room for every day, the dates only for HOLIDAY_MAX of them
+  uint8_t kept = 0;
+  for (uint16_t day = 0; day < HOLIDAY_DAYS; day++)
+  {
+    if (is_holiday(config, day))
+    {
+      if (kept < HOLIDAY_MAX)
+      {
+        kept++;
+      }
+      else
+      {
+        bit_set(config.holidays, day, false);
+      }
+    }
+  }
+}
 
-  case 5: // TIME_ALARMS_MENU -> SET_TIME_ALARMS_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(">Set timer"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(" Delete timer"));
-    break;
+//+ Replays the newest record of every setting from the EEPROM log, settings never saved stay at their defaults
+void load_settings()
+{
+  uint8_t data[JOURNAL_DATA_SIZE];
 
-  case 6: // TIME_ALARMS_MENU -> RESET_TIME_ALARMS_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(" Set timer"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(">Delete timer"));
-    break;
+  for (uint8_t i = 0; i < TIME_ALARM_COUNT; i++)
+  {
+    config.alarm_days[i] = ALL_DAYS;
+  }
 
-  case 7: // TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_PROGRAM
+  if (config_log.begin() == 0)
+  {
+    // an empty log: the settings of a unit from before the log are carried over into it once
+    if (load_legacy_settings())
+    {
+      for (uint8_t key = 0; key < CONFIG_KEYS; key++)
+      {
+        mark_setting_dirty(key);
+      }
+    }
+    mark_setting_dirty(CONFIG_VERSION_KEY);
+    save_settings();
+    return;
+  }
 
-    break;
+  // records written with another version are rewritten whole straight away, so none of the old records is taken for a
+  // setting once the version record matches: those of version 1 carried over, those of any other version (not
+  // understood) with the defaults
+  uint8_t version = config_log.read(CONFIG_VERSION_KEY, data) ? data[0] : 0;
+  if (version != CONFIG_VERSION)
+  {
+    if (version == 1)
+    {
+      load_v1_settings();
+    }
+    for (uint8_t key = 0; key < CONFIG_KEYS; key++)
+    {
+      mark_setting_dirty(key);
+    }
+    save_settings();
+    return;
+  }
 
-  case 8: // TIME_ALARMS_MENU -> SET_TIME_ALARMS_MENU -> SET_TIME_ALARMS_PROGRAM
+  for (uint8_t i = 0; i < TIME_ALARM_COUNT; i++)
+  {
+    load_time_alarm(i, time_alarm_key(i));
+  }
 
-    break;
+  for (uint8_t record = 0; record < HOLIDAY_RECORDS; record++)
+  {
+    if (config_log.read(HOLIDAY_KEY + record, data))
+    {
+      uint32_t packed = data[0] | (data[1] << 8) | (uint32_t)(data[2] | (data[3] << 8)) << 16;
+      for (uint8_t slot = 0; slot < HOLIDAYS_PER_RECORD; slot++)
+      {
+        uint16_t day = (packed >> (slot * HOLIDAY_BITS)) & HOLIDAY_NONE;
+        if (day < HOLIDAY_DAYS)
+        {
+          bit_set(config.holidays, day, true);
+        }
+      }
+    }
+  }
 
-  case 9: // TIME_ALARMS_MENU -> RESET_TIME_ALARMS_MENU -> RESET_TIME_ALARMS_PROGRAM
+  load_volt_alarm();
+}
 
-    break;
+//+ Sets a time alarm in RAM, stores it in EEPROM and recompiles the alarms (used by the menus and the console)
+void commit_time_alarm(int index, uint16_t on_minute, uint16_t off_minute, uint8_t days, bool active)
+{
+  // Setting the live variables
+  config.alarm_on[index] = on_minute;
+  config.alarm_off[index] = off_minute;
+  config.alarm_days[index] = days;
+  set_alarm_active(config, index, active);
 
-  case 10: // VOLT_ALARM_MENU -> SET_VOLT_ALARM_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(" View volt alarm"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(">Set volt alarm"));
-    break;
+  // Pushing to EEPROM
+  mark_setting_dirty(time_alarm_key(index));
+  save_settings();
 
-  case 11: // VOLT_ALARM_MENU -> VIEW_VOLT_ALARM_MENU -> VIEW_VOLTAGE_ALARM_PROGRAM
-    break;
-  case 12: // VOLT_ALARM_MENU -> SET_VOLT_ALARM_MENU -> SET_VOLTAGE_ALARM_PROGRAM
-    break;
+  rebuild_alarm_table();
+}
 
-  case 13: // SET_TIME_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(" Voltage alarm"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(">Set/view time"));
-    analogWrite(OUT_led_pin, 127); // Brighten the display
-    break;
+//+ Marks a calendar day as a holiday or not, stores it in EEPROM and recompiles the alarms (used by the console);
+// returns false if there are already HOLIDAY_MAX holidays
+bool commit_holiday(uint16_t calendar_day, bool holiday)
+{
+  if (holiday && !is_holiday(config, calendar_day) && holiday_count() >= HOLIDAY_MAX)
+  {
+    return false;
+  }
+  bit_set(config.holidays, calendar_day, holiday);
 
-  case 14: // SET_TIME_MENU -> VIEW_DATETIME_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(">View datetime"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(" Set datetime"));
-    break;
+  // the dates after it move along the list, the records that come out the same are not rewritten
+  for (uint8_t record = 0; record < HOLIDAY_RECORDS; record++)
+  {
+    mark_setting_dirty(HOLIDAY_KEY + record);
+  }
+  save_settings();
 
-  case 15: // SET_TIME_MENU -> SET_DATETIME_MENU
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(F(" View datetime"));
-    lcd.setCursor(0, 1);
-    lcd.print(F(">Set datetime"));
-    break;
+  rebuild_alarm_table();
+  return true;
+}
 
-  default:
-    break;
+//+ Resets the time arrays at a given index and stores the result in EEPROM and RAM
+void reset_time(int index)
+{
+  commit_time_alarm(index, 0, 0, ALL_DAYS, false);
+
+  reset_temp_time_variables();
+}
+
+//+ Handles the entry of voltage values
+int handle_volt_entry(int cursorPos, int *pvolt)
+{
+  /* Voltage is entered as an array of 4 integers in the format
+    as XX.Y where XX is the voltage and Y is the hundreds of millivolts
+
+   e.g. 11.5 (11.5V) is represented as 11.5
+
+   NOTE: Only the 0,1,and 3 indices are used and the index 2 is left blank intentionally. 
+   
+  */
+
+  int periodPos = 2;
+  int maxPos = 3;
+  int minPos = 0;
+  int currentDigit = *(pvolt + cursorPos);
+
+  if (up.rose())
+  {
+    if (currentDigit < 9 && cursorPos != periodPos)
+    {
+
+      currentDigit += 1;
+      *(pvolt + cursorPos) = currentDigit;
+      lcd.setCursor(cursorPos, 1);
+      lcd.print(digit_char(currentDigit));
+      lcd.setCursor(cursorPos, 1);
+      lcd.cursor();
+    }
+  }
+  if (dn.rose())
+  {
+    if (currentDigit > 0 && cursorPos != periodPos)
+    {
+      currentDigit -= 1;
+      *(pvolt + cursorPos) = currentDigit;
+      lcd.setCursor(cursorPos, 1);
+      lcd.print(digit_char(currentDigit));
+      lcd.setCursor(cursorPos, 1);
+      lcd.cursor();
+    }
+  }
+  if (lt.rose())
+  {
+    if (cursorPos > minPos)
+    {
+      cursorPos -= 1;
+
+      // this is done so that the cursor never reaches period index
+      if (cursorPos == periodPos)
+      {
+        cursorPos -= 1;
+      }
+    }
+  }
+  if (rt.rose())
+  {
+    if (cursorPos < maxPos)
+    {
+      cursorPos += 1;
+
+      // this is done so that the cursor never reaches period index
+      if (cursorPos == periodPos)
+      {
+        cursorPos += 1;
+      }
+    }
+  }
+  if (ok.rose())
+  {
+    cursorPos = 0;
+    lcd.setCursor(cursorPos, 1);
+    lcd.noCursor();
+  }
+  return cursorPos;
+}
+
+//+ Handles the entry of date time values
+int handle_new_date_time_entry(int cursorPos, int *pnewdatetime)
+{
+  /* New datetime is entered as an array of 16 integers in the format
+    as YYYY0MM0DD0HH0MM
+
+   
+
+  // Note: the indices at position 4,7,10 and 13 are left blank intentionally   
+  */
+
+  int maxPos = 15;
+  int minPos = 0;
+  int currentDigit = *(pnewdatetime + cursorPos);
+
+  if (up.rose())
+  {
+    if (currentDigit < 9 && (cursorPos != 4 || cursorPos != 7 || cursorPos != 10 || cursorPos != 13))
+    {
+      currentDigit += 1;
+      *(pnewdatetime + cursorPos) = currentDigit;
+      lcd.setCursor(cursorPos, 1);
+      lcd.print(digit_char(currentDigit));
+      lcd.setCursor(cursorPos, 1);
+      lcd.cursor();
+    }
+  }
+  if (dn.rose())
+  {
+    if (currentDigit > 0 && (cursorPos != 4 || cursorPos != 7 || cursorPos != 10 || cursorPos != 13))
+    {
+      currentDigit -= 1;
+      *(pnewdatetime + cursorPos) = currentDigit;
+      lcd.setCursor(cursorPos, 1);
+      lcd.print(digit_char(currentDigit));
+      lcd.setCursor(cursorPos, 1);
+      lcd.cursor();
+    }
   }
+  if (lt.rose())
+  {
+    if (cursorPos > minPos)
+    {
+      cursorPos -= 1;
+
+      // this is done so that the cursor never reaches period index
+      if (cursorPos == 4 || cursorPos == 7 || cursorPos == 10 || cursorPos == 13)
+      {
+        cursorPos -= 1;
+      }
+    }
+  }
+  if (rt.rose())
+  {
+    if (cursorPos < maxPos)
+    {
+      cursorPos += 1;
+
+      // this is done so that the cursor never reaches period index
+      if (cursorPos == 4 || cursorPos == 7 || cursorPos == 10 || cursorPos == 13)
+      {
+        cursorPos += 1;
+      }
+    }
+  }
+  if (ok.rose())
+  {
+    cursorPos = 0;
+    lcd.setCursor(cursorPos, 1);
+    lcd.noCursor();
+  }
+  return cursorPos;
+}
+
+//+ This function returns the measured voltage (in decivolts)
+// The ADC samples continuously in the background, so this only converts the running average
+int measure_voltage()
+{
+  return counts_to_decivolts(hal_adc_average());
+}
+
+//+ Converts the voltage alarm thresholds into ADC counts, call whenever config.volt_on or config.volt_off change
+void update_volt_thresholds()
+{
+  ON_volt_counts = counts_at_or_below(config.volt_on);
+  OFF_volt_counts = counts_at_or_above(config.volt_off);
+}
+
+//+ Sets the voltage alarm in RAM and stores it in EEPROM (used by the menus and the console)
+void commit_volt_alarm(uint16_t on_decivolts, uint16_t off_decivolts)
+{
+  // Setting the live variables
+  config.volt_on = on_decivolts;
+  config.volt_off = off_decivolts;
+  config.volt_active = true;
+  update_volt_thresholds();
+
+  //! Saving the voltages to EEPROM
+  mark_setting_dirty(VOLT_ALARM_KEY);
+  save_settings();
 }
 
 /* 
@@ -780,13 +1246,37 @@ void update_menu(int state)
 ????????????????????????????????????
 */
 
+//+ Draws the current time and voltage onto the idle screen (run on every second tick while idle)
+void draw_idle_screen()
+{
+  HalDateTime now = sys_clock.now();
+
+  if (now.second() == 0)
+  {
+    lcd.clear();
+  }
+  lcd.setCursor(0, 0);
+  lcd.print(F(" Time :"));
+  lcd.print(F(" "));
+  lcd.print(now.hour());
+  lcd.print(':');
+  lcd.print(now.minute());
+  lcd.print(':');
+  lcd.print(now.second());
+  lcd.print(F("  "));
+
+  voltage = measure_voltage();
+  lcd.setCursor(0, 1);
+  // a * in the corner while saved settings are still being written to EEPROM
+  lcd.print(storage.pending() ? '*' : ' ');
+  lcd.print(F("Voltage :"));
+  print_decivolts(voltage);
+  lcd.print(F("V"));
+}
+
 //+ Show the idle screen which is dimmed and has the current time and voltage
 void show_idle_screen()
 {
-  /* 
-todo: have 2 seperate states where 1st does init and the 2nd does 
-todo: the showing time; to free up CPU time
- */
   //* Setting the global states to their defaults
 
   if (need_clean)
@@ -803,6 +1293,8 @@ todo: the showing time; to free up CPU time
     view_datetime_state = 0;
     set_datetime_state = 0;
 
+    view_diagnostics_state = 0;
+
     reset_temp_volt_variables();
     reset_temp_time_variables();
     reset_temp_datetime_variables();
@@ -813,35 +1305,55 @@ todo: the showing time; to free up CPU time
     lcd.noCursor();
 
     need_clean = 0;
+
+    // the screen is redrawn straight away instead of waiting for the next second tick
+    draw_idle_screen();
   }
+}
+
+// * Time alarms section
+/* Up and down page through the time alarms this many at a time, left and right step through them one by one */
+#define ALARM_PAGE_SIZE 10
 
-  DateTime now = rtc.now();
-  if (prev_sec != now.second())
+//+ Moves index through the time alarms with the buttons of this pass, returns true if it moved
+bool scroll_alarms(int &index)
+{
+  int next = index;
+  if (rt.rose())
   {
-    if (now.second() == 0)
-    {
-      lcd.clear();
-    }
-    prev_sec = now.second();
-    lcd.setCursor(0, 0);
-    lcd.print(F(" Time :"));
-    lcd.print(F(" "));
-    lcd.print(now.hour());
-    lcd.print(':');
-    lcd.print(now.minute());
-    lcd.print(':');
-    lcd.print(now.second());
-    lcd.print(F("  "));
+    next += 1;
+  }
+  else if (lt.rose())
+  {
+    next -= 1;
+  }
+  else if (dn.rose())
+  {
+    next += ALARM_PAGE_SIZE;
+  }
+  else if (up.rose())
+  {
+    next -= ALARM_PAGE_SIZE;
+  }
 
-    voltage = measure_voltage();
-    lcd.setCursor(0, 1);
-    lcd.print(F(" Voltage :"));
-    lcd.print((voltage / 10.0));
-    lcd.print(F("V"));
+  // a page past either end stops at the first or the last alarm
+  if (next < 0)
+  {
+    next = 0;
+  }
+  else if (next > TIME_ALARM_COUNT - 1)
+  {
+    next = TIME_ALARM_COUNT - 1;
   }
+
+  if (next == index)
+  {
+    return false;
+  }
+  index = next;
+  return true;
 }
 
-// * Time alarms section
 //+ Displays and allows the scrolling through all the alarms
 void view_time_alarms()
 {
@@ -852,6 +1364,7 @@ void view_time_alarms()
   if (view_time_alarm_state == 0)
   {
     al_num = 0;
+    view_alarm_days = false;
     lcd.clear();
 
     view_time_alarm_state = 1;
@@ -861,33 +1374,49 @@ void view_time_alarms()
   // The first alarm is shown
   if (view_time_alarm_state == 1)
   {
-
-    // calculates the length of the string temporary time variables and stores it
-    static int index_last = int((sizeof(ON_times_s)) / (sizeof(ON_times_s[0])) - 1);
-
-    if (rt.rose() && al_num < index_last)
+    if (scroll_alarms(al_num))
     {
-      al_num += 1;
-
-      lcd.clear();
-    }
-    else if (lt.rose() && al_num > 0)
-    {
-      al_num -= 1;
-
       lcd.clear();
     }
 
     lcd.setCursor(0, 0);
     lcd.print(F("ON:"));
-    lcd.print(ON_times_s[al_num]);
+    print_hhmm(config.alarm_on[al_num]);
     lcd.print(F(" "));
     lcd.print(F("OFF:"));
-    lcd.print(OFF_times_s[al_num]);
+    print_hhmm(config.alarm_off[al_num]);
     lcd.setCursor(0, 1);
     lcd.print(F("<-("));
     lcd.print(al_num + 1);
     lcd.print(F(")->"));
+
+    // OK switches between the days of this alarm and the next switching event out of all the alarms
+    if (ok.rose())
+    {
+      view_alarm_days = !view_alarm_days;
+      lcd.clear();
+    }
+
+    AlarmEvent next;
+    HalDateTime now = sys_clock.now();
+    if (view_alarm_days)
+    {
+      lcd.setCursor(9, 1);
+      print_days(config.alarm_days[al_num]);
+    }
+    else if (alarm_table.next_event(now.hour() * 60 + now.minute(), next))
+    {
+      lcd.setCursor(9, 1);
+      if (next.relay_on)
+      {
+        lcd.print(F("ON "));
+      }
+      else
+      {
+        lcd.print(F("OFF"));
+      }
+      print_hhmm(next.minute);
+    }
   }
 }
 
@@ -912,8 +1441,8 @@ void set_time_alarm()
     }
 
     // resetting the temporary time variables
-    time_on_temp_s = "0000";
-    time_off_temp_s = "0000";
+    copy_text(time_on_temp_s, "0000", TIME_TEXT_SIZE);
+    copy_text(time_off_temp_s, "0000", TIME_TEXT_SIZE);
 
     lcd.clear();
     lcd.setCursor(0, 0);
@@ -928,25 +1457,9 @@ void set_time_alarm()
   // This is the select alarm screen
   if (set_time_alarm_state == 4)
   {
-
-    // calculates the length of the string arrays that store time ON and time OFF variables and stores it
-    static int index_last = int((sizeof(ON_times_s)) / (sizeof(ON_times_s[0])) - 1);
-
-    // increment/decrement the selected alarm number
-    if (rt.rose() && al_num < index_last)
-    {
-      al_num += 1;
-      lcd.clear();
-
-      lcd.setCursor(0, 0);
-      lcd.print(F("Select alarm: "));
-      lcd.setCursor(0, 1);
-      lcd.print(F("Alarm "));
-      lcd.print(al_num + 1);
-    }
-    else if (lt.rose() && al_num > 0)
+    // change the selected alarm number
+    if (scroll_alarms(al_num))
     {
-      al_num -= 1;
       lcd.clear();
 
       lcd.setCursor(0, 0);
@@ -981,7 +1494,7 @@ void set_time_alarm()
     lcd.print(temp_time_alarm_num + 1);
     lcd.print(F(" ON time"));
     lcd.setCursor(0, 1);
-    lcd.print(ON_times_s[temp_time_alarm_num]);
+    print_hhmm(config.alarm_on[temp_time_alarm_num]);
 
     // if a button is pressed then display the cursor and go to another state
     if (up.rose() || dn.rose() || lt.rose() || rt.rose())
@@ -989,8 +1502,8 @@ void set_time_alarm()
       lcd.setCursor(cursorPos, 1);
       lcd.cursor();
 
-      int temp_time = ON_times_s[temp_time_alarm_num].toInt();
-      //Serial.println(temp_time);
+      int temp_time = minute_to_hhmm(config.alarm_on[temp_time_alarm_num]);
+      //serial.println(temp_time);
 
       int temp_d1 = temp_time / 1000;
       time_on_temp[0] = temp_d1;
@@ -1010,7 +1523,7 @@ void set_time_alarm()
     // this is if the time is already the correct time
     else if (ok.rose())
     {
-      time_on_temp_s = ON_times_s[temp_time_alarm_num];
+      format_uint(time_on_temp_s, minute_to_hhmm(config.alarm_on[temp_time_alarm_num]), 4);
       set_time_alarm_state = 8;
     }
   }
@@ -1027,7 +1540,7 @@ void set_time_alarm()
     else if (ok.rose())
     {
       // Saving the chosen time to a temporary variable
-      time_on_temp_s = String(*(ptimeon)) + String(*(ptimeon + 1)) + String(*(ptimeon + 2)) + String(*(ptimeon + 3));
+      format_time_digits(time_on_temp_s, ptimeon);
       set_time_alarm_state = 8;
     }
   }
@@ -1052,15 +1565,15 @@ void set_time_alarm()
     lcd.print(temp_time_alarm_num + 1);
     lcd.print(F(" OFF time"));
     lcd.setCursor(0, 1);
-    lcd.print(OFF_times_s[temp_time_alarm_num]);
+    print_hhmm(config.alarm_off[temp_time_alarm_num]);
 
     if (up.rose() || dn.rose() || lt.rose() || rt.rose())
     {
       lcd.setCursor(cursorPos, 1);
       lcd.cursor();
 
-      int temp_time = OFF_times_s[temp_time_alarm_num].toInt();
-      //Serial.println(temp_time);
+      int temp_time = minute_to_hhmm(config.alarm_off[temp_time_alarm_num]);
+      //serial.println(temp_time);
 
       int temp_d1 = temp_time / 1000;
       time_off_temp[0] = temp_d1;
@@ -1080,7 +1593,7 @@ void set_time_alarm()
     // this is if the time is already the correct time
     else if (ok.rose())
     {
-      time_off_temp_s = OFF_times_s[temp_time_alarm_num];
+      format_uint(time_off_temp_s, minute_to_hhmm(config.alarm_off[temp_time_alarm_num]), 4);
       set_time_alarm_state = 11;
     }
   }
@@ -1097,13 +1610,56 @@ void set_time_alarm()
     else if (ok.rose())
     {
       // Saving the chosen time to a temporary variable
-      time_off_temp_s = String(*(ptimeoff)) + String(*(ptimeoff + 1)) + String(*(ptimeoff + 2)) + String(*(ptimeoff + 3));
+      format_time_digits(time_off_temp_s, ptimeoff);
       set_time_alarm_state = 11;
     }
   }
 
   // Debouncing the OK button
   if (set_time_alarm_state == 11)
+  {
+    if (ok.fell())
+    {
+      lcd.clear();
+      lcd.noCursor();
+      cursorPos = 0;
+      time_days_temp = config.alarm_days[temp_time_alarm_num];
+      set_time_alarm_state = 14;
+    }
+  }
+
+  // This is the edit days screen, left and right pick a day and up or down switches it on or off
+  if (set_time_alarm_state == 14)
+  {
+    if (lt.rose() && cursorPos > 0)
+    {
+      cursorPos--;
+    }
+    else if (rt.rose() && cursorPos < 6)
+    {
+      cursorPos++;
+    }
+    else if (up.rose() || dn.rose())
+    {
+      time_days_temp ^= 1 << cursorPos;
+    }
+    else if (ok.rose())
+    {
+      set_time_alarm_state = 15;
+    }
+
+    lcd.setCursor(0, 0);
+    lcd.print(F("Edit "));
+    lcd.print(temp_time_alarm_num + 1);
+    lcd.print(F(" days"));
+    lcd.setCursor(0, 1);
+    print_days(time_days_temp);
+    lcd.setCursor(cursorPos, 1);
+    lcd.cursor();
+  }
+
+  // Debouncing the OK button
+  if (set_time_alarm_state == 15)
   {
     if (ok.fell())
     {
@@ -1123,26 +1679,15 @@ void set_time_alarm()
     lcd.print(F(" OFF "));
     lcd.print(time_off_temp_s);
     lcd.setCursor(0, 1);
+    print_days(time_days_temp);
     lcd.print(F(" Confirm?"));
 
     // saving the times to memory if ok
     if (ok.rose())
     {
-      // Setting the live variables
-      ON_times_s[temp_time_alarm_num] = time_on_temp_s;
-      OFF_times_s[temp_time_alarm_num] = time_off_temp_s;
-      active_alarms[temp_time_alarm_num] = true;
-
-      // Setting the EEPROM stored variables
-      time_on_temp_s.toCharArray(ee_on[temp_time_alarm_num], 5);
-      time_off_temp_s.toCharArray(ee_off[temp_time_alarm_num], 5);
-      ee_active[temp_time_alarm_num] = true;
-
-      //! Saving the time to EEPROM
-      // Pushing to EEPROM
-      EEPROM.put(ee_on_address, ee_on);
-      EEPROM.put(ee_off_address, ee_off);
-      EEPROM.put(ee_set_address, ee_active);
+      // Setting the live variables and saving them to EEPROM
+      commit_time_alarm(temp_time_alarm_num, hhmm_to_minute(parse_digits(time_on_temp_s)),
+                        hhmm_to_minute(parse_digits(time_off_temp_s)), time_days_temp, true);
 
       reset_temp_time_variables();
       // switching to the next state
@@ -1184,19 +1729,8 @@ void reset_time_alarm()
   // The first alarm is shown
   if (reset_time_alarm_state == 1)
   {
-    // calculates the value of the index of the last alarm
-    static int index_of_last_alarm = int((sizeof(ON_times_s)) / (sizeof(ON_times_s[0])) - 1);
-
-    if (rt.rose() && al_num < index_of_last_alarm)
+    if (scroll_alarms(al_num))
     {
-      al_num += 1;
-
-      lcd.clear();
-    }
-    else if (lt.rose() && al_num > 0)
-    {
-      al_num -= 1;
-
       lcd.clear();
     }
     else if (ok.rose())
@@ -1209,10 +1743,10 @@ void reset_time_alarm()
 
     lcd.setCursor(0, 0);
     lcd.print(F("ON:"));
-    lcd.print(ON_times_s[al_num]);
+    print_hhmm(config.alarm_on[al_num]);
     lcd.print(F(" "));
     lcd.print(F("OFF:"));
-    lcd.print(OFF_times_s[al_num]);
+    print_hhmm(config.alarm_off[al_num]);
     lcd.setCursor(0, 1);
     lcd.print(F("<-("));
     lcd.print(al_num + 1);
@@ -1251,45 +1785,6 @@ void reset_time_alarm()
   }
 }
 
-//+ Checks whether a time alarm is triggered and handles the output
-//needs to be delayed after running to prevent flickering of relay
-void handle_time_alarms()
-{
-
-  // defining the time
-  DateTime now = rtc.now();
-
-  // dividing the size of the whole array by the size of an element to find the
-  // number of elements
-  int numTimers = sizeof(active_alarms) / sizeof(active_alarms[0]);
-
-  if (now.second() == 0)
-  {
-    for (int i = 0; i < numTimers; i++)
-    {
-      // checking if the alarm is set before proceeding
-      if (active_alarms[i])
-      {
-        // time is of the format 24 hr format
-        int now_int = (now.hour() * 100) + (now.minute());
-
-        // checking the ON time alarms
-        if (ON_times_s[i].toInt() == now_int)
-        {
-          // SWITCH ON THE RELAY
-          digitalWrite(OUT_relay_pin, HIGH);
-        }
-        else if (OFF_times_s[i].toInt() == now_int)
-        {
-
-          // SWITCH OFF THE RELAY
-          digitalWrite(OUT_relay_pin, LOW);
-        }
-      }
-    }
-  }
-}
-
 // * Voltage alarms section
 //+ Display the voltages at which the relay will be triggered ON and OFF
 void view_volt_alarm()
@@ -1311,12 +1806,12 @@ void view_volt_alarm()
   {
     lcd.setCursor(0, 0);
     lcd.print(F("ON "));
-    lcd.print(ON_volt_s);
+    print_decivolts(config.volt_on);
     lcd.print(F(" OFF "));
-    lcd.print(OFF_volt_s);
+    print_decivolts(config.volt_off);
     lcd.setCursor(0, 1);
     lcd.print(F("Voltage now:"));
-    lcd.print(voltage / 10.0);
+    print_decivolts(voltage);
   }
 }
 
@@ -1350,8 +1845,8 @@ void set_voltage_alarm()
     }
 
     // resetting the temporary voltage variables
-    volt_on_temp_s = "00.0";
-    volt_off_temp_s = "00.0";
+    copy_text(volt_on_temp_s, "00.0", VOLT_TEXT_SIZE);
+    copy_text(volt_off_temp_s, "00.0", VOLT_TEXT_SIZE);
 
     // state to show that the menu is displayed
     if (ok.rose())
@@ -1376,11 +1871,11 @@ void set_voltage_alarm()
     lcd.setCursor(0, 0);
     lcd.print(F("Edit  ON volt"));
     lcd.setCursor(0, 1);
-    lcd.print(ON_volt_s);
+    print_decivolts(config.volt_on);
 
-    volt_on_temp[0] = ON_volt_s.substring(0, 1).toInt();
-    volt_on_temp[1] = ON_volt_s.substring(1, 2).toInt();
-    volt_on_temp[3] = ON_volt_s.substring(3).toInt();
+    volt_on_temp[0] = config.volt_on / 100;
+    volt_on_temp[1] = config.volt_on / 10 % 10;
+    volt_on_temp[3] = config.volt_on % 10;
 
     // if a button is pressed then display the cursor and go to another state
     if (up.rose() || dn.rose() || lt.rose() || rt.rose())
@@ -1394,7 +1889,7 @@ void set_voltage_alarm()
     // this is if the voltage is already the correct voltage
     else if (ok.rose())
     {
-      volt_on_temp_s = String(volt_on_temp[0]) + String(volt_on_temp[1]) + String(".") + String(volt_on_temp[3]);
+      format_volt_digits(volt_on_temp_s, volt_on_temp);
       set_volt_alarm_state = 8;
     }
     else if (bc.rose())
@@ -1417,7 +1912,7 @@ void set_voltage_alarm()
     else if (ok.rose())
     {
       // Saving the chosen voltage to a temporary variable
-      volt_on_temp_s = String(volt_on_temp[0]) + String(volt_on_temp[1]) + String(".") + String(volt_on_temp[3]);
+      format_volt_digits(volt_on_temp_s, volt_on_temp);
       set_volt_alarm_state = 8;
     }
     else if (bc.rose())
@@ -1446,11 +1941,11 @@ void set_voltage_alarm()
     lcd.setCursor(0, 0);
     lcd.print(F("Edit OFF volt"));
     lcd.setCursor(0, 1);
-    lcd.print(OFF_volt_s);
+    print_decivolts(config.volt_off);
 
-    volt_off_temp[0] = OFF_volt_s.substring(0, 1).toInt();
-    volt_off_temp[1] = OFF_volt_s.substring(1, 2).toInt();
-    volt_off_temp[3] = OFF_volt_s.substring(3).toInt();
+    volt_off_temp[0] = config.volt_off / 100;
+    volt_off_temp[1] = config.volt_off / 10 % 10;
+    volt_off_temp[3] = config.volt_off % 10;
 
     if (up.rose() || dn.rose() || lt.rose() || rt.rose())
     {
@@ -1463,7 +1958,7 @@ void set_voltage_alarm()
     // this is if the time is already the correct time
     else if (ok.rose())
     {
-      volt_off_temp_s = String(volt_off_temp[0]) + String(volt_off_temp[1]) + String(".") + String(volt_off_temp[3]);
+      format_volt_digits(volt_off_temp_s, volt_off_temp);
 
       set_volt_alarm_state = 11;
     }
@@ -1487,7 +1982,7 @@ void set_voltage_alarm()
     else if (ok.rose())
     {
       // Saving the chosen time to a temporary variable
-      volt_off_temp_s = String(volt_off_temp[0]) + String(volt_off_temp[1]) + String(".") + String(volt_off_temp[3]);
+      format_volt_digits(volt_off_temp_s, volt_off_temp);
       set_volt_alarm_state = 11;
     }
     else if (bc.rose())
@@ -1524,28 +2019,8 @@ void set_voltage_alarm()
     // saving the times to memory if ok
     if (ok.rose())
     {
-
-      // Setting the live variables
-      ON_volt_s = volt_on_temp_s;
-      OFF_volt_s = volt_off_temp_s;
-
-      ON_volt = int(volt_on_temp_s.toFloat() * 10);
-      OFF_volt = int(volt_off_temp_s.toFloat() * 10);
-
-      // Setting the local persistant stored variables
-      for (int i; i < 4; i++)
-      {
-        ee_volts_on[i] = volt_on_temp[i];
-        ee_volts_off[i] = volt_off_temp[i];
-      }
-
-      ee_volts_active = true;
-
-      //! Saving the time to EEPROM
-      // Pushing to EEPROM
-      EEPROM.put(ee_volts_on_address, ee_volts_on);
-      EEPROM.put(ee_volts_off_address, ee_volts_off);
-      EEPROM.put(ee_volts_set_address, ee_volts_active);
+      // Setting the live variables and saving them to EEPROM
+      commit_volt_alarm(parse_digits(volt_on_temp_s), parse_digits(volt_off_temp_s));
 
       reset_temp_volt_variables();
 
@@ -1584,32 +2059,127 @@ void set_voltage_alarm()
   }
 }
 
+//+ Notes when the averaged voltage first crosses a threshold that the relay has not acted on (run on every pass)
+void watch_volt_crossing()
+{
+  int counts = hal_adc_average();
+  uint8_t relay = hal_gpio_read(OUT_relay_pin);
+  bool crossed = (counts <= ON_volt_counts && relay != HIGH) || (counts >= OFF_volt_counts && relay != LOW);
+
+  // a crossing that goes back before the relay acts on it is forgotten
+  if (!crossed)
+  {
+    volt_crossed = false;
+  }
+  else if (!volt_crossed)
+  {
+    volt_crossed = true;
+    volt_crossed_ms = hal_millis();
+  }
+}
+
+//+ Switches the relay for the voltage alarm, timing the switch from the crossing that called for it
+void switch_volt_relay(uint8_t level)
+{
+  if (volt_crossed && hal_gpio_read(OUT_relay_pin) != level)
+  {
+    relay_latency.add(hal_millis() - volt_crossed_ms);
+    volt_crossed = false;
+  }
+  hal_gpio_write(OUT_relay_pin, level);
+}
+
 //+ Checks whether a voltage alarm is triggered and handles the output
-//needs to be delayed after running to prevent flickering of relay
-void handle_volt_alarm(int volt_measured)
+// Runs once every VOLT_SAMPLE_PERIOD, which keeps the relay from flickering
+// The measurement is in raw ADC counts and compared against the thresholds converted by update_volt_thresholds()
+void handle_volt_alarm(int counts_measured)
 {
   /* The logic level for switching are inverted in this relay module;
   so HIGH turns OFF the relay and LOW makes it switch to ON. */
 
   //(to charge the battery))
-  if (volt_measured <= ON_volt)
+  if (counts_measured <= ON_volt_counts)
   {
     //Close the relay contacts to charge the battery
-    digitalWrite(OUT_relay_pin, HIGH);
+    switch_volt_relay(HIGH);
   }
   //(battery has finished charging)
-  else if (volt_measured >= OFF_volt)
+  else if (counts_measured >= OFF_volt_counts)
   {
     //Open the relay contacts to stop charging the battery
-    digitalWrite(OUT_relay_pin, LOW);
+    switch_volt_relay(LOW);
   }
-  else if (ON_volt < volt_measured && volt_measured < OFF_volt)
+  else if (ON_volt_counts < counts_measured && counts_measured < OFF_volt_counts)
   {
     // DO NOTHING
     // Let the relay remain in its state until one of the switching conditions are met
   }
 }
 
+// * Diagnostics section
+//+ Prints a latency on the LCD, capped to 4 digits
+void print_latency(uint16_t ms)
+{
+  lcd.print((int)(ms > 9999 ? 9999 : ms));
+}
+
+//+ Shows the median, 90th percentile and worst of the latencies in the window, up and down switch between the button
+// and the relay latencies
+// The screen is only drawn again when the page changes or a measurement is added to the window, as clearing it and
+// sorting the windows on every pass flickers and adds to the very latencies shown.
+void view_diagnostics()
+{
+  //setting flag to show variables are in memory that need cleaning
+  need_clean = 1;
+
+  if (view_diagnostics_state == 0)
+  {
+    lcd.noCursor();
+    diagnostics_page = 0;
+  }
+
+  bool page_changed = up.rose() || dn.rose();
+  if (page_changed)
+  {
+    diagnostics_page = !diagnostics_page;
+  }
+
+  const LatencyWindow &window = diagnostics_page == 0 ? button_latency : relay_latency;
+
+  if (view_diagnostics_state == 1 && !page_changed && window.added() == diagnostics_shown)
+  {
+    return;
+  }
+  view_diagnostics_state = 1;
+  diagnostics_shown = window.added();
+
+  lcd.clear();
+  lcd.setCursor(0, 0);
+  lcd.print(diagnostics_page == 0 ? F("Button>LCD n=") : F("Volt>relay n="));
+  lcd.print((int)window.count());
+  lcd.setCursor(0, 1);
+  print_latency(window.percentile(50));
+  lcd.print('/');
+  print_latency(window.percentile(90));
+  lcd.print('/');
+  print_latency(window.percentile(100));
+  lcd.print(F("ms"));
+}
+
+//+ Prints one latency window over serial
+void print_latency_window(const __FlashStringHelper *name, const LatencyWindow &window)
+{
+  serial.print(name);
+  serial.print(F(" ms n="));
+  serial.print((long)window.count());
+  serial.print(F(" p50="));
+  serial.print((long)window.percentile(50));
+  serial.print(F(" p90="));
+  serial.print((long)window.percentile(90));
+  serial.print(F(" max="));
+  serial.println((long)window.percentile(100));
+}
+
 // * Datetime section
 //+ Shows the current date and time
 void view_datetime()
@@ -1624,7 +2194,7 @@ void view_datetime()
   }
   if (view_datetime_state == 1)
   {
-    DateTime now = rtc.now();
+    HalDateTime now = sys_clock.now();
 
     lcd.setCursor(0, 0);
     lcd.print(F("Date:"));
@@ -1661,7 +2231,7 @@ void set_datetime()
   if (set_datetime_state == 1)
   {
     // obtains the time as of running
-    DateTime now = rtc.now();
+    HalDateTime now = sys_clock.now();
     int year = now.year();
     int month = now.month();
     int day = now.day();
@@ -1779,10 +2349,10 @@ void set_datetime()
       newhour = date_time_temp[11] * 10 + date_time_temp[12];
       newminute = date_time_temp[14] * 10 + date_time_temp[15];
 
-      DateTime newDate = DateTime(newyear, newmonth, newday, newhour, newminute);
+      HalDateTime newDate = HalDateTime(newyear, newmonth, newday, newhour, newminute);
       if (newDate.isValid())
       {
-        rtc.adjust(newDate);
+        sys_clock.adjust(newDate);
         set_datetime_state = 3;
       }
       else
@@ -1841,189 +2411,677 @@ void set_datetime()
   }
 }
 
-// * The main loop program
-//+ THE MAIN PROGRAM: A finite state machine that handles states and transitions
-// View this code alongside the update_menu function for clarity
-int handle_states(int curr)
+// * Scheduled jobs
+//+ Returns the clock edges (TICK_SECOND, TICK_MINUTE) seen since the last call
+uint8_t detect_clock_ticks(const HalDateTime &now)
 {
+  uint8_t ticks = 0;
 
-  int next_state = curr;
-
-  switch (curr)
+  // the first reading after start up only sets the reference values
+  if (prev_sec >= 0 && prev_sec != now.second())
   {
+    ticks |= TICK_SECOND;
+  }
+  if (prev_min >= 0 && prev_min != now.minute())
+  {
+    ticks |= TICK_MINUTE;
+  }
 
-  // IDLE STATE
-  case 0:
-
-    // shows the idle screen
-    show_idle_screen();
+  prev_sec = now.second();
+  prev_min = now.minute();
 
-    // listens to an input and switcHes state accordingly
-    next_state = handle_button_inputs(1, 1, 1, 1, 1, 1, curr);
+  return ticks;
+}
 
-    if (next_state != curr)
-      update_menu(next_state);
+//+ Minute tick: checks the time alarms
+void minute_job()
+{
+  handle_time_alarms();
+}
 
-    break;
+//+ Sample tick: measures the voltage and checks the voltage alarm
+void volt_sample_job()
+{
+  uint16_t counts = hal_adc_average();
 
-    // HOME -> TIME_ALARMS_MENU
-  case 1:
-    next_state = handle_button_inputs(curr, 2, curr, curr, 3, curr, curr);
+  // store the measured voltage into the global voltage variable
+  voltage = counts_to_decivolts(counts);
 
-    if (next_state != curr)
-      update_menu(next_state);
+  // use the raw reading to decide what to do to the relay
+  handle_volt_alarm(counts);
+}
 
-    break;
+//+ UI tick: refreshes the idle screen once a second
+void ui_job()
+{
+  if (state == 0 && !need_clean)
+  {
+    draw_idle_screen();
+  }
+}
 
-  // HOME -> VOLT_ALARM_MENU
-  case 2:
-    next_state = handle_button_inputs(1, 13, curr, curr, 4, curr, curr);
+//+ Minute tick: works out the awake time per second since the last one, reported by the state command of the console
+void power_job()
+{
+  unsigned long now_ms = hal_millis();
+  unsigned long elapsed = now_ms - power_report_ms;
 
-    if (next_state != curr)
-      update_menu(next_state);
+  if (elapsed == 0 || asleep_ms > elapsed)
+  {
+    return;
+  }
 
-    break;
+  awake_ms_per_s = (elapsed - asleep_ms) * 1000 / elapsed;
+  asleep_ms = 0;
+  power_report_ms = now_ms;
+}
 
-    // TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_MENU
-  case 3:
-    next_state = handle_button_inputs(curr, 5, curr, curr, 7, 1, curr);
+// * Power down
+//+ Powers the arduino down until the next RTC tick (or a button), then puts the clock on that tick
+void power_down()
+{
+  unsigned long now_ms = hal_millis();
+  uint16_t ms_to_tick = sys_clock.ms_to_edge(now_ms);
 
-    if (next_state != curr)
-      update_menu(next_state);
+  // stays awake while the edge is too close to tell apart, and until the screen, the settings and a console reply are
+  // written
+  if (!sqw_ticking || ms_to_tick == 0 || storage.pending() || display.bus_stats().depth != 0 ||
+      console_listing != LIST_NONE)
+  {
+    return;
+  }
 
-    break;
+  uint32_t next_second = sys_clock.seconds() + 1;
 
-  // VOLT_ALARM_MENU -> VIEW_VOLT_ALARM_MENU
-  case 4:
+  // the PWM stops in power down, so the backlight is set fully on or off rather than left stuck at either level
+  hal_gpio_pwm(OUT_led_pin, SLEEP_BACKLIGHT);
 
-    next_state = handle_button_inputs(curr, 10, curr, curr, 11, 2, curr);
+  uint8_t wake = hal_sleep(now_ms + ms_to_tick);
 
-    if (next_state != curr)
-      update_menu(next_state);
+  if (wake == HAL_WAKE_TICK)
+  {
+    asleep_ms += ms_to_tick;
+    sys_clock.second_edge(hal_millis(), next_second);
+    return;
+  }
 
-    break;
+  if (wake == HAL_WAKE_TIMEOUT)
+  {
+    sqw_ticking = false;
+    serial.println(F("No RTC square wave, staying awake"));
+  }
+  else if (wake == HAL_WAKE_SERIAL)
+  {
+    // stays awake for the rest of the input
+    console_activity_ms = hal_millis();
+  }
 
-  // TIME_ALARMS_MENU -> SET_TIME_ALARMS_MENU
-  case 5:
+  // millis() missed part of the power down
+  sys_clock.resync(hal_millis());
+}
 
-    next_state = handle_button_inputs(3, 6, curr, curr, 8, 1, curr);
+// * Serial console
+//+ Prints a number as exactly width digits
+void serial_print_digits(uint16_t value, uint8_t width)
+{
+  char text[6];
+  format_uint(text, value, width);
+  serial.print(text);
+}
 
-    if (next_state != curr)
-      update_menu(next_state);
+//+ Prints a minute of the day as HH:MM
+void serial_print_hhmm(uint16_t minute)
+{
+  serial_print_digits(minute / 60, 2);
+  serial.print(F(":"));
+  serial_print_digits(minute % 60, 2);
+}
 
-    break;
+//+ Prints a voltage in decivolts as XX.Y
+void serial_print_decivolts(uint16_t decivolts)
+{
+  char text[VOLT_TEXT_SIZE];
+  format_decivolts(text, decivolts);
+  serial.print(text);
+}
 
-  // TIME_ALARMS_MENU -> RESET_TIME_ALARMS_MENU
-  case 6:
+//+ Prints a weekday mask as SMTWTFS
+void serial_print_days(uint8_t days)
+{
+  char text[DAYS_TEXT_SIZE];
+  format_days(text, days);
+  serial.print(text);
+}
 
-    next_state = handle_button_inputs(5, curr, curr, curr, 9, 1, curr);
+//+ A line of the holidays, one per date
+bool print_holiday_line(uint8_t line)
+{
+  // the holiday the line is for, counted from the start of the year
+  uint16_t day = 0;
+  for (uint16_t found = 0; day < HOLIDAY_DAYS; day++)
+  {
+    if (is_holiday(config, day) && found++ == line)
+    {
+      break;
+    }
+  }
+  if (day == HOLIDAY_DAYS)
+  {
+    return false;
+  }
 
-    if (next_state != curr)
-      update_menu(next_state);
+  // the calendar days are the days of 2000, a leap year
+  HalDateTime date = HalDateTime::from_seconds(day * SECONDS_PER_DAY);
+  serial.print(F("holiday "));
+  serial_print_digits(date.month(), 2);
+  serial.print(F("-"));
+  serial_print_digits(date.day(), 2);
+  serial.println();
+  return true;
+}
 
+//+ A line of the help
+bool print_help_line(uint8_t line)
+{
+  const __FlashStringHelper *text;
+  switch (line)
+  {
+  case 0:
+    text = F("alarms                list the time alarms");
+    break;
+  case 1:
+    text = F("alarm N HH:MM HH:MM  set time alarm N (ON OFF)");
+    break;
+  case 2:
+    text = F("  [SMTWTFS]          days it runs, e.g. -MTWTF-");
+    break;
+  case 3:
+    text = F("alarm N del          delete time alarm N");
+    break;
+  case 4:
+    text = F("holidays             list the holidays");
+    break;
+  case 5:
+    text = F("holiday MM-DD on|off no time alarms on a date");
+    break;
+  case 6:
+    text = F("volt [ON OFF]        show or set the volt alarm");
     break;
-
-  // TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_PROGRAM
   case 7:
-    view_time_alarms();
-
-    if (next_state != curr)
-      update_menu(next_state);
-
+    text = F("time [Y-M-D H:M[:S]] show or set the datetime");
     break;
-
-  // TIME_ALARMS_MENU -> SET_TIME_ALARMS_MENU -> SET_TIME_ALARMS_PROGRAM
   case 8:
-
-    set_time_alarm();
-
-    if (next_state != curr)
-      update_menu(next_state);
-
+    text = F("state                show the state");
     break;
-
-  // TIME_ALARMS_MENU -> RESET_TIME_ALARMS_MENU -> RESET_TIME_ALARMS_PROGRAM
   case 9:
-
-    reset_time_alarm();
-
-    if (next_state != curr)
-      update_menu(next_state);
-
+    text = F("stats                show the latencies & queues");
     break;
-
-  // VOLT_ALARM_MENU -> SET_VOLT_ALARM_MENU
+#ifdef LOOP_PROFILE
   case 10:
+    text = F("profile [reset]      show or clear the profile");
+    break;
+#endif
+  default:
+    return false;
+  }
+  serial.println(text);
+  return true;
+}
+
+//+ A line of the state
+bool print_state_line(uint8_t line)
+{
+  switch (line)
+  {
+  case 0:
+    serial.print(F("menu "));
+    serial.print((long)state);
+    serial.print(F(" relay "));
+    serial.print((long)hal_gpio_read(OUT_relay_pin));
+    serial.print(F(" voltage "));
+    serial_print_decivolts(measure_voltage());
+    serial.println();
+    return true;
+  case 1:
+    serial.print(F("clock locked "));
+    serial.print((long)sys_clock.locked());
+    serial.print(F(" drift "));
+    serial.print((long)sys_clock.drift_ppm());
+    serial.println(F("ppm"));
+    return true;
+  case 2:
+    serial.print(F("eeprom pending "));
+    serial.print((long)storage.pending());
+    serial.print(F(" records "));
+    serial.print((long)config_log.writes());
+    serial.print(F(" passes "));
+    serial.print((long)config_log.bank_passes(0));
+    serial.print(F("/"));
+    serial.println((long)config_log.bank_passes(1));
+    return true;
+  case 3:
+    serial.print(F("power sqw "));
+    serial.print((long)sqw_ticking);
+    serial.print(F(" awake "));
+    serial.print((long)awake_ms_per_s);
+    serial.println(F("ms/s"));
+    return true;
+  default:
+    return false;
+  }
+}
 
-    next_state = handle_button_inputs(4, curr, curr, curr, 12, 2, curr);
+//+ A line of the statistics
+bool print_stats_line(uint8_t line)
+{
+  HalBusStats bus;
+  switch (line)
+  {
+  case 0:
+    print_latency_window(F("Button>LCD"), button_latency);
+    return true;
+  case 1:
+    print_latency_window(F("Volt>relay"), relay_latency);
+    return true;
+  case 2:
+    bus = display.bus_stats();
+    serial.print(F("lcd queue peak "));
+    serial.print((long)bus.peak);
+    serial.print(F("/"));
+    serial.print((long)bus.capacity);
+    serial.print(F(" dropped "));
+    serial.print((long)bus.overflows);
+    serial.print(F(" errors "));
+    serial.println((long)bus.errors);
+    return true;
+  case 3:
+    serial.print(F("buttons dropped "));
+    serial.println((long)buttons.overflows());
+    return true;
+  default:
+    return false;
+  }
+}
 
-    if (next_state != curr)
-      update_menu(next_state);
+//+ Prints line number line of the reply being listed, returns false once there are no more lines
+bool print_console_line(uint8_t line)
+{
+  switch (console_listing)
+  {
+  case LIST_REPLY:
+    if (line > 0)
+    {
+      return false;
+    }
+    serial.println(console_reply);
+    return true;
+  case LIST_HELP:
+    return print_help_line(line);
+  case LIST_ALARMS:
+    if (line >= TIME_ALARM_COUNT)
+    {
+      return false;
+    }
+    serial.print(F("alarm "));
+    serial.print((long)line + 1);
+    serial.print(F(" "));
+    serial_print_hhmm(config.alarm_on[line]);
+    serial.print(F(" "));
+    serial_print_hhmm(config.alarm_off[line]);
+    serial.print(F(" "));
+    serial_print_days(config.alarm_days[line]);
+    serial.println(alarm_is_active(config, line) ? F(" active") : F(" inactive"));
+    return true;
+  case LIST_HOLIDAYS:
+    return print_holiday_line(line);
+  case LIST_VOLT:
+    if (line > 0)
+    {
+      return false;
+    }
+    serial.print(F("volt "));
+    serial_print_decivolts(config.volt_on);
+    serial.print(F(" "));
+    serial_print_decivolts(config.volt_off);
+    serial.println(config.volt_active ? F(" active") : F(" inactive"));
+    return true;
+  case LIST_TIME:
+    if (line > 0)
+    {
+      return false;
+    }
+    {
+      HalDateTime now = sys_clock.now();
+      serial.print(F("time "));
+      serial_print_digits(now.year(), 4);
+      serial.print(F("-"));
+      serial_print_digits(now.month(), 2);
+      serial.print(F("-"));
+      serial_print_digits(now.day(), 2);
+      serial.print(F(" "));
+      serial_print_hhmm(now.hour() * 60 + now.minute());
+      serial.print(F(":"));
+      serial_print_digits(now.second(), 2);
+      serial.println();
+    }
+    return true;
+  case LIST_STATE:
+    return print_state_line(line);
+  case LIST_STATS:
+    return print_stats_line(line);
+#ifdef LOOP_PROFILE
+  case LIST_PROFILE:
+    return loop_profile.print_line(serial, line);
+#endif
+  default:
+    return false;
+  }
+}
 
-    break;
+//+ alarm N HH:MM HH:MM [SMTWTFS] sets time alarm N, alarm N del deletes it
+void run_alarm_command()
+{
+  uint16_t number;
+  if (!parse_fields(console.word(1), ' ', &number, 1) || number < 1 || number > TIME_ALARM_COUNT)
+  {
+    console_reply = F("error: no such alarm");
+    return;
+  }
+  int index = number - 1;
 
-  // VOLT_ALARM_MENU -> VIEW_VOLT_ALARM_MENU -> VIEW_VOLTAGE_ALARM_PROGRAM
-  case 11:
+  if (console.words() == 3 && strcmp_P(console.word(2), PSTR("del")) == 0)
+  {
+    commit_time_alarm(index, 0, 0, ALL_DAYS, false);
+    return;
+  }
 
-    view_volt_alarm();
+  // every day unless the days are given
+  uint16_t on[2];
+  uint16_t off[2];
+  uint8_t days = ALL_DAYS;
+  if (console.words() < 4 || console.words() > 5 || !parse_fields(console.word(2), ':', on, 2) ||
+      !parse_fields(console.word(3), ':', off, 2) || on[0] > 23 || on[1] > 59 || off[0] > 23 || off[1] > 59 ||
+      (console.words() == 5 && !parse_days(console.word(4), days)))
+  {
+    console_reply = F("error: alarm N HH:MM HH:MM [SMTWTFS]");
+    return;
+  }
+  commit_time_alarm(index, on[0] * 60 + on[1], off[0] * 60 + off[1], days, true);
+}
 
-    if (next_state != curr)
-      update_menu(next_state);
+//+ holiday MM-DD on|off marks a date as a holiday, when no time alarm runs, or clears it
+void run_holiday_command()
+{
+  uint16_t date[2] = {0, 0};
+  bool on = strcmp_P(console.word(2), PSTR("on")) == 0;
 
-    break;
-  // VOLT_ALARM_MENU -> SET_VOLT_ALARM_MENU -> SET_VOLTAGE_ALARM_PROGRAM
-  case 12:
+  bool valid = parse_fields(console.word(1), '-', date, 2) && date[0] <= 12 && date[1] <= 31 &&
+               (on || strcmp_P(console.word(2), PSTR("off")) == 0);
 
-    set_voltage_alarm();
+  // the date is checked in 2000, a leap year, so 29 Feb can be a holiday too
+  HalDateTime day(2000, valid ? date[0] : 0, date[1]);
+  if (!valid || !day.isValid())
+  {
+    console_reply = F("error: holiday MM-DD on|off");
+    return;
+  }
+  if (!commit_holiday(day.calendar_day(), on))
+  {
+    console_reply = F("error: too many holidays");
+  }
+}
 
-    if (next_state != curr)
-      update_menu(next_state);
+//+ volt ON OFF sets the voltage alarm
+void run_volt_command()
+{
+  uint16_t on;
+  uint16_t off;
 
-    break;
-  // SET_NEW_TIME_MENU
-  case 13:
-    next_state = handle_button_inputs(2, curr, curr, curr, 14, 2, curr);
+  // the screens show XX.Y, and the relay would chatter with ON at or above OFF
+  if (!parse_decivolts(console.word(1), on) || !parse_decivolts(console.word(2), off) || off > 999 || on >= off)
+  {
+    console_reply = F("error: volt ON OFF, e.g. volt 11.5 13.5");
+    return;
+  }
+  commit_volt_alarm(on, off);
+}
 
-    if (next_state != curr)
-      update_menu(next_state);
+//+ time YYYY-MM-DD HH:MM[:SS] sets the RTC and the clock
+void run_time_command()
+{
+  uint16_t date[3];
+  uint16_t time[3] = {0, 0, 0};
 
-    break;
+  bool valid = parse_fields(console.word(1), '-', date, 3) &&
+               (parse_fields(console.word(2), ':', time, 3) || parse_fields(console.word(2), ':', time, 2)) &&
+               date[0] >= 2000 && date[0] <= 2099 && time[0] <= 23 && time[1] <= 59 && time[2] <= 59;
+
+  HalDateTime new_date(valid ? date[0] : 0, date[1], date[2], time[0], time[1], time[2]);
+  if (!valid || !new_date.isValid())
+  {
+    console_reply = F("error: time YYYY-MM-DD HH:MM[:SS]");
+    return;
+  }
+  sys_clock.adjust(new_date);
+}
 
-  // SET_TIME_MENU -> VIEW_DATETIME_MENU
-  case 14:
-    next_state = handle_button_inputs(curr, 15, curr, curr, 16, 13, curr);
+//+ Runs the command on the finished console line and starts its reply
+void run_console_command()
+{
+  const char *command = console.word(0);
+  uint8_t words = console.words();
 
-    if (next_state != curr)
-      update_menu(next_state);
+  console_listing = LIST_REPLY;
+  console_line = 0;
+  console_reply = F("ok");
 
-    break;
+  if (console.overflowed())
+  {
+    console_reply = F("error: line too long");
+  }
+  else if (words == 0)
+  {
+    console_listing = LIST_NONE;
+  }
+  else if (strcmp_P(command, PSTR("help")) == 0)
+  {
+    console_listing = LIST_HELP;
+  }
+  else if (strcmp_P(command, PSTR("alarms")) == 0 && words == 1)
+  {
+    console_listing = LIST_ALARMS;
+  }
+  else if (strcmp_P(command, PSTR("alarm")) == 0)
+  {
+    run_alarm_command();
+  }
+  else if (strcmp_P(command, PSTR("holidays")) == 0 && words == 1)
+  {
+    console_listing = LIST_HOLIDAYS;
+  }
+  else if (strcmp_P(command, PSTR("holiday")) == 0 && words == 3)
+  {
+    run_holiday_command();
+  }
+  else if (strcmp_P(command, PSTR("volt")) == 0 && words == 1)
+  {
+    console_listing = LIST_VOLT;
+  }
+  else if (strcmp_P(command, PSTR("volt")) == 0 && words == 3)
+  {
+    run_volt_command();
+  }
+  else if (strcmp_P(command, PSTR("time")) == 0 && words == 1)
+  {
+    console_listing = LIST_TIME;
+  }
+  else if (strcmp_P(command, PSTR("time")) == 0 && words == 3)
+  {
+    run_time_command();
+  }
+  else if (strcmp_P(command, PSTR("state")) == 0 && words == 1)
+  {
+    console_listing = LIST_STATE;
+  }
+  else if (strcmp_P(command, PSTR("stats")) == 0 && words == 1)
+  {
+    console_listing = LIST_STATS;
+  }
+#ifdef LOOP_PROFILE
+  else if (strcmp_P(command, PSTR("profile")) == 0 && words == 1)
+  {
+    console_listing = LIST_PROFILE;
+  }
+  else if (strcmp_P(command, PSTR("profile")) == 0 && words == 2 && strcmp_P(console.word(1), PSTR("reset")) == 0)
+  {
+    loop_profile.reset();
+  }
+#endif
+  else
+  {
+    console_reply = F("error: unknown command, try help");
+  }
+}
 
-    // SET_TIME_MENU -> SET_DATETIME_MENU
-  case 15:
-    next_state = handle_button_inputs(14, curr, curr, curr, 17, 13, curr);
+//+ The serial console: takes in the received characters and prints the reply a line per pass, without ever waiting
+// on the UART (the UART stops in power down, the character that wakes the arduino is lost)
+void handle_console()
+{
+  if (console_listing != LIST_NONE)
+  {
+    if (serial.availableForWrite() >= CONSOLE_LINE_ROOM && !print_console_line(console_line++))
+    {
+      console_listing = LIST_NONE;
+    }
+    return;
+  }
 
-    if (next_state != curr)
-      update_menu(next_state);
+  // the next line waits in the receive buffer until the reply to this one is out
+  while (serial.available() > 0)
+  {
+    console_activity_ms = hal_millis();
+    if (console.feed(serial.read()))
+    {
+      run_console_command();
+      return;
+    }
+  }
+}
 
-    break;
-  case 16:
+// * The main loop program
+/* The menu states, indexed by the state number. Each row lists where up, down, left, right, ok and back lead, the
+two lines shown on entering the state and the program that runs while in it. */
+const MenuState MENU[] PROGMEM = {
+    // 0: IDLE STATE, any button opens the menu
+    {1, 1, 1, 1, 1, 1, "", "", show_idle_screen},
+    // 1: HOME -> TIME_ALARMS_MENU
+    {MENU_STAY, 2, MENU_STAY, MENU_STAY, 3, MENU_STAY, ">Time alarms", " Voltage alarm", 0},
+    // 2: HOME -> VOLT_ALARM_MENU
+    {1, 13, MENU_STAY, MENU_STAY, 4, MENU_STAY, " Time alarms", ">Voltage alarm", 0},
+    // 3: TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_MENU
+    {MENU_STAY, 5, MENU_STAY, MENU_STAY, 7, 1, ">View timer(s)", " Set timer", 0},
+    // 4: VOLT_ALARM_MENU -> VIEW_VOLT_ALARM_MENU
+    {MENU_STAY, 10, MENU_STAY, MENU_STAY, 11, 2, ">View volt alarm", " Set volt alarm", 0},
+    // 5: TIME_ALARMS_MENU -> SET_TIME_ALARMS_MENU
+    {3, 6, MENU_STAY, MENU_STAY, 8, 1, ">Set timer", " Delete timer", 0},
+    // 6: TIME_ALARMS_MENU -> RESET_TIME_ALARMS_MENU
+    {5, MENU_STAY, MENU_STAY, MENU_STAY, 9, 1, " Set timer", ">Delete timer", 0},
+    // 7: TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_MENU -> VIEW_TIME_ALARMS_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", view_time_alarms},
+    // 8: TIME_ALARMS_MENU -> SET_TIME_ALARMS_MENU -> SET_TIME_ALARMS_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", set_time_alarm},
+    // 9: TIME_ALARMS_MENU -> RESET_TIME_ALARMS_MENU -> RESET_TIME_ALARMS_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", reset_time_alarm},
+    // 10: VOLT_ALARM_MENU -> SET_VOLT_ALARM_MENU
+    {4, MENU_STAY, MENU_STAY, MENU_STAY, 12, 2, " View volt alarm", ">Set volt alarm", 0},
+    // 11: VOLT_ALARM_MENU -> VIEW_VOLT_ALARM_MENU -> VIEW_VOLTAGE_ALARM_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", view_volt_alarm},
+    // 12: VOLT_ALARM_MENU -> SET_VOLT_ALARM_MENU -> SET_VOLTAGE_ALARM_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", set_voltage_alarm},
+    // 13: SET_TIME_MENU
+    {2, 18, MENU_STAY, MENU_STAY, 14, 2, " Voltage alarm", ">Set/view time", 0},
+    // 14: SET_TIME_MENU -> VIEW_DATETIME_MENU
+    {MENU_STAY, 15, MENU_STAY, MENU_STAY, 16, 13, ">View datetime", " Set datetime", 0},
+    // 15: SET_TIME_MENU -> SET_DATETIME_MENU
+    {14, MENU_STAY, MENU_STAY, MENU_STAY, 17, 13, " View datetime", ">Set datetime", 0},
+    // 16: SET_TIME_MENU -> VIEW_DATETIME_MENU -> VIEW_DATETIME_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", view_datetime},
+    // 17: SET_TIME_MENU -> SET_DATETIME_MENU -> SET_DATETIME_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", set_datetime},
+    // 18: DIAGNOSTICS_MENU
+    {13, MENU_STAY, MENU_STAY, MENU_STAY, 19, 13, " Set/view time", ">Diagnostics", 0},
+    // 19: DIAGNOSTICS_MENU -> VIEW_DIAGNOSTICS_PROGRAM
+    {MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, MENU_STAY, "", "", view_diagnostics},
+};
+
+const uint8_t MENU_STATES = sizeof(MENU) / sizeof(MENU[0]);
+
+//+ Draws the two lines of a menu state when it is entered
+void draw_menu(const MenuState &row)
+{
+  if (row.line0[0] == '\0')
+  {
+    return;
+  }
+  lcd.clear();
+  lcd.setCursor(0, 0);
+  lcd.print(row.line0);
+  lcd.setCursor(0, 1);
+  lcd.print(row.line1);
+}
 
-    // run the view_datetime function
-    view_datetime();
+//+ THE MAIN PROGRAM: A finite state machine driven by the MENU table
+int handle_states(int curr)
+{
+  if (curr < 0 || curr >= MENU_STATES)
+  {
+    return 0;
+  }
 
-    break;
-  case 17:
+  MenuState row;
+  read_menu_state(MENU, curr, row);
 
-    //run the set_datetime function
-    set_datetime();
+  if (row.program)
+  {
+    row.program();
+  }
 
-    break;
+  // the first button that rose picks the transition
+  uint8_t target = MENU_STAY;
+  if (up.rose())
+  {
+    target = row.up;
+  }
+  else if (dn.rose())
+  {
+    target = row.down;
+  }
+  else if (lt.rose())
+  {
+    target = row.left;
+  }
+  else if (rt.rose())
+  {
+    target = row.right;
+  }
+  else if (ok.rose())
+  {
+    target = row.ok;
+  }
+  else if (bc.rose())
+  {
+    target = row.back;
+  }
 
-  default:
-    break;
+  if (target == MENU_STAY || target == curr)
+  {
+    return curr;
   }
 
-  return next_state;
+  MenuState next;
+  read_menu_state(MENU, target, next);
+  draw_menu(next);
+  return target;
 }
 
 /*
@@ -2041,134 +3099,101 @@ void setup()
 {
 
   // put your setup code here, to run once:
-  Serial.begin(9600);
+  serial.begin(9600);
 
-  lcd.begin(16, 2);
-  lcd.clear();
+  lcd.begin();
 
   // Dimming the LCD display
-  analogWrite(OUT_led_pin, 10);
+  hal_gpio_pwm(OUT_led_pin, 10);
 
   // Defining the RELAY pin
-  pinMode(OUT_relay_pin, OUTPUT);
-
-  pinMode(IN_voltage_pin, INPUT);
-
-  // Attaching the debounce objects to their pins.
-  up.attach(IN_up_btn_pin, INPUT);
-  dn.attach(IN_down_btn_pin, INPUT);
-  lt.attach(IN_left_btn_pin, INPUT);
-  rt.attach(IN_right_btn_pin, INPUT);
-  ok.attach(IN_sel_btn_pin, INPUT);
-  bc.attach(IN_back_btn_pin, INPUT);
-
-  // Setting up the intervals for the debouncing.
-  up.interval(50);
-  dn.interval(50);
-  lt.interval(50);
-  rt.interval(50);
-  ok.interval(50);
-  bc.interval(50);
-
-  /*   // only comment these out when initialising a device
-  EEPROM.put(ee_on_address, ee_on);
-  EEPROM.put(ee_off_address, ee_off);
-  EEPROM.put(ee_set_address, ee_active);
-
-  EEPROM.put(ee_volts_on_address, ee_volts_on);
-  EEPROM.put(ee_volts_off_address, ee_volts_off);
-  EEPROM.put(ee_volts_active, ee_volts_active);
-  */
-
-  // reading time eeprom values during startup
-  char read_ee_on[10][5];
-  char read_ee_off[10][5];
-  bool read_active[10];
+  hal_gpio_mode(OUT_relay_pin, OUTPUT);
 
-  EEPROM.get(ee_on_address, read_ee_on);
-  EEPROM.get(ee_off_address, read_ee_off);
-  EEPROM.get(ee_set_address, read_active);
-
-  for (size_t i = 0; i < 10; i++)
-  {
-    ON_times_s[i] = String(read_ee_on[i]);
-    OFF_times_s[i] = String(read_ee_off[i]);
-    active_alarms[i] = read_active[i];
-  }
+  hal_gpio_mode(IN_voltage_pin, INPUT);
 
-  // reading voltage eeprom values during startup
+  // Starting the background sampling of the voltage
+  hal_adc_start(IN_voltage_pin);
 
-  int read_ee_volts_on[4];
-  int read_ee_volts_off[4];
-  bool read_volts_active;
+  // Debouncing the button pins from their current levels
+  hal_input_begin(BUTTON_PINS);
+  buttons.begin(BUTTON_PINS, hal_input_levels(), hal_millis());
 
-  EEPROM.get(ee_volts_on_address, read_ee_volts_on);
-  EEPROM.get(ee_volts_off_address, read_ee_volts_off);
-  EEPROM.get(ee_volts_set_address, read_volts_active);
+  // Replaying the settings stored in EEPROM
+  load_settings();
+  update_volt_thresholds();
 
-  ON_volt_s = String(read_ee_volts_on[0]) + String(read_ee_volts_on[1]) + String(".") + String(read_ee_volts_on[3]);
-  OFF_volt_s = String(read_ee_volts_off[0]) + String(read_ee_volts_off[1]) + String(".") + String(read_ee_volts_off[3]);
-  ON_volt = read_ee_volts_on[0] * 100 + read_ee_volts_on[1] * 10 + read_ee_volts_on[3];
-  OFF_volt = read_ee_volts_off[0] * 100 + read_ee_volts_off[1] * 10 + read_ee_volts_off[3];
-  volt_active = read_volts_active;
+  // The wear of the EEPROM, every cell of a bank is written once per pass
+  serial.print(F("EEPROM log passes: "));
+  serial.print((long)config_log.bank_passes(0));
+  serial.print(F(" / "));
+  serial.println((long)config_log.bank_passes(1));
 
   if (!rtc.begin())
   {
-    Serial.println(F("Couldn't find RTC"));
-    Serial.flush();
+    serial.println(F("Couldn't find RTC"));
+    serial.flush();
     abort();
   }
 
   if (!rtc.isrunning())
   {
-    Serial.println(F("RTC is NOT running, let's set the time!"));
+    serial.println(F("RTC is NOT running, let's set the time!"));
     // When time needs to be set on a new device, or after a power loss, the
     // following line sets the RTC to the date & time this sketch was compiled
-    rtc.adjust(DateTime(F(__DATE__), F(__TIME__)));
+    rtc.adjust(HalDateTime::build_time());
   }
+
+  // The RTC is only read again by the software clock when it re-syncs
+  sys_clock.begin(rtc);
+
+  // The RTC ticks once a second on its square wave output, which wakes the arduino from power down
+  rtc.square_wave(true);
+  hal_sleep_begin(IN_sqw_pin);
+
+  // The alarms read from EEPROM are compiled once the time is known, nothing is reported yet so the relay is put in
+  // the state they want
+  rebuild_alarm_table();
+
+  // Registering the jobs that loop() runs
+  scheduler.on_tick(TICK_MINUTE, minute_job);
+  scheduler.every(VOLT_SAMPLE_PERIOD, volt_sample_job);
+  scheduler.on_tick(TICK_SECOND, ui_job);
+  scheduler.on_tick(TICK_MINUTE, power_job);
+
+  // Timing the stages of loop() (only in builds with LOOP_PROFILE)
+  PROFILE_BEGIN();
 }
 
 void loop()
 {
-  DateTime now = rtc.now();
+  PROFILE_START();
 
-  // Button states are refreshed
-  up.update();
-  dn.update();
-  lt.update();
-  rt.update();
-  ok.update();
-  bc.update();
+  sys_clock.update(hal_millis());
+  HalDateTime now = sys_clock.now();
+  PROFILE_STAGE(STAGE_CLOCK);
 
-  // checks whether time alarms have been activated every minute
-  if (now.second() == 0)
+  // The changes of the debounced buttons are queued and the next button event is taken for this pass
+  HalInputSample sample;
+  while (hal_input_next(sample))
   {
-
-    handle_time_alarms();
-
-    // delay to prevent flickering of relay
-    delay(250);
+    buttons.sample(sample.levels, sample.time_ms);
   }
-  // checks the voltage every 5 seconds
-  else if (now.second() % 5 == 0)
-  {
-    // store the measured voltage into the global voltage variable
-    voltage = measure_voltage();
-
-    // use the global voltage to decide what to do to the relay
-    handle_volt_alarm(voltage);
+  buttons.update(hal_millis());
+  PROFILE_STAGE(STAGE_BUTTONS);
 
-    // delayed to prevent flickering of relay
-    delay(100);
-  }
+  // runs the alarm, voltage and screen jobs that are due on this pass
+  watch_volt_crossing();
+  scheduler.run(hal_millis(), detect_clock_ticks(now));
+  PROFILE_STAGE(STAGE_JOBS);
 
-  bool go_to_sleep = ((up.currentDuration() > T_SLEEP) && (dn.currentDuration() > T_SLEEP) && (lt.currentDuration() > T_SLEEP) && (rt.currentDuration() > T_SLEEP) && (ok.currentDuration() > T_SLEEP) && (bc.currentDuration() > T_SLEEP));
+  bool go_to_sleep = hal_millis() - buttons.last_activity() > (unsigned long)T_SLEEP &&
+                     hal_millis() - console_activity_ms > (unsigned long)T_SLEEP;
 
   // Switches the arduino to the low power state if no button inputs have changed for T_SLEEP milliseconds
   if (go_to_sleep)
   {
-    // Dims the display
-    analogWrite(OUT_led_pin, 10);
+    // Dims the display, to the level it keeps through the power downs if they come so it does not blink on the ticks
+    hal_gpio_pwm(OUT_led_pin, sqw_ticking ? SLEEP_BACKLIGHT : 10);
 
     // Shows the idle screen
     state = 0;
@@ -2176,8 +3201,30 @@ void loop()
   else
   {
     // Brigtens the display
-    analogWrite(OUT_led_pin, 127);
+    hal_gpio_pwm(OUT_led_pin, 127);
   }
 
   state = handle_states(state);
+  PROFILE_STAGE(STAGE_MENU);
+
+  // sends whatever changed on screen during this pass
+  unsigned long flush_ms = hal_millis();
+  uint8_t cells_sent = lcd.flush();
+  PROFILE_STAGE(STAGE_DISPLAY);
+
+  // a press that changed the screen on its own pass, timed to the first byte sent for it
+  unsigned long press_ms;
+  if (cells_sent > 0 && buttons.pressed(press_ms))
+  {
+    button_latency.add(flush_ms - press_ms);
+  }
+
+  // While idle the arduino is powered down between the RTC ticks
+  if (go_to_sleep)
+  {
+    power_down();
+  }
+  PROFILE_STAGE(STAGE_SLEEP);
+
+  handle_console();
 }
@@ -0,0 +1,67 @@
+/*
+*Overview: Implementation of the cooperative job scheduler used by loop().
+*/
+
+#include "scheduler.h"
+#include "hal.h"
+
+Scheduler::Scheduler()
+{
+  job_count = 0;
+}
+
+bool Scheduler::every(unsigned long period_ms, Job job)
+{
+  if (job_count >= MAX_JOBS)
+  {
+    return false;
+  }
+
+  Entry &entry = jobs[job_count++];
+  entry.job = job;
+  entry.period_ms = period_ms;
+  entry.last_ms = hal_millis();
+  entry.tick_mask = 0;
+  return true;
+}
+
+bool Scheduler::on_tick(uint8_t tick_mask, Job job)
+{
+  if (job_count >= MAX_JOBS)
+  {
+    return false;
+  }
+
+  Entry &entry = jobs[job_count++];
+  entry.job = job;
+  entry.period_ms = 0;
+  entry.last_ms = 0;
+  entry.tick_mask = tick_mask;
+  return true;
+}
+
+void Scheduler::run(unsigned long now_ms, uint8_t ticks)
+{
+  for (uint8_t i = 0; i < job_count; i++)
+  {
+    Entry &entry = jobs[i];
+
+    if (entry.tick_mask != 0)
+    {
+      if (ticks & entry.tick_mask)
+      {
+        entry.job();
+      }
+    }
+    else if (now_ms - entry.last_ms >= entry.period_ms)
+    {
+      // keep the job on its original grid, but skip missed periods instead of running them in a burst
+      entry.last_ms += entry.period_ms;
+      if (now_ms - entry.last_ms >= entry.period_ms)
+      {
+        entry.last_ms = now_ms;
+      }
+      entry.job();
+    }
+  }
+}
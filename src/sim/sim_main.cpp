@@ -0,0 +1,533 @@
+/*
+*Overview: Host entry point for [env:sim], a deterministic simulator of the relay over days or months of virtual time.
+*          The real setup() and loop() run against the simulated hardware, driven by a scenario script (voltage
+*          waveform, button presses, console commands), and every relay transition, console line and optionally LCD
+*          frame is printed as a timeline. Most virtual seconds are spent powered down between RTC ticks, so a month
+*          runs in about a minute, and the same script on the same firmware always gives the same timeline: diff the
+*          output of two builds to see what a change did.
+*
+*Usage: program <scenario file, - for stdin> [-l to include the LCD frames]
+*
+*Scenario: one event per line, in time order, # starts a comment. The time of an event is the virtual time since the
+*          start as [<days>d]HH:MM:SS[.mmm], e.g. 2d06:30:00 or 00:00:01.500.
+*
+*          start YYYY-MM-DD HH:MM:SS    datetime of the RTC at the start (first line only, default 2022-01-01 12:00:00)
+*          drift <ppm>                  RTC running fast (positive) or slow (negative), before the first event
+*          <time> volts <XX.Y>          steps the voltage on A0
+*          <time> ramp <XX.Y>           slopes the voltage linearly from the previous voltage event to this one
+*          <time> adc <counts>          steps A0 to a raw ADC reading
+*          <time> press <button> [ms]   presses up, down, left, right, select or back (150ms unless given)
+*          <time> serial <text>         sends a line to the serial console
+*          <time> expect relay <on|off> checks the relay, a wrong state is printed and fails the run (exit status 1)
+*          <time> end                   ends the simulation (otherwise it ends at the last event)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal_host.h"
+#include "text_format.h"
+#include "volt_fixed.h"
+
+// Virtual time spent outside the firmware on each pass of loop(), roughly the Arduino core overhead
+static const unsigned long LOOP_OVERHEAD_US = 10;
+
+// Presses are handed to the simulated hardware this far ahead, so they wake the firmware from a power down in time
+static const unsigned long long PRESS_LOOKAHEAD_US = (HAL_SLEEP_TIMEOUT_MS + 500) * 1000ULL;
+
+static const unsigned long DEFAULT_PRESS_MS = 150;
+
+static const uint8_t LCD_VISIBLE_COLS = 16;
+
+/* The pins of main.cpp */
+static const uint8_t RELAY_PIN = 8;
+static const uint8_t VOLTAGE_PIN = A0;
+
+struct ButtonPin
+{
+  const char *name;
+  uint8_t pin;
+};
+
+static const ButtonPin BUTTONS[] = {
+    {"up", 3}, {"down", 2}, {"left", 4}, {"right", 5}, {"select", 7}, {"back", 6},
+};
+static const uint8_t BUTTON_COUNT = sizeof(BUTTONS) / sizeof(BUTTONS[0]);
+
+/* The scenario */
+static const uint8_t EVENT_VOLTS = 0;
+static const uint8_t EVENT_RAMP = 1;
+static const uint8_t EVENT_ADC = 2;
+static const uint8_t EVENT_PRESS = 3;
+static const uint8_t EVENT_SERIAL = 4;
+static const uint8_t EVENT_END = 5;
+static const uint8_t EVENT_EXPECT = 6;
+
+static const int LINE_SIZE = 128;
+
+struct Event
+{
+  unsigned long long at_us;
+  uint8_t type;
+  uint8_t pin;             // press
+  unsigned long hold_ms;   // press
+  int counts;              // volts, ramp and adc
+  uint8_t level;           // expect
+  char text[LINE_SIZE];    // the script line as written, and the console line of serial
+};
+
+static Event *events = NULL;
+static int event_count = 0;
+
+static HalDateTime start_datetime(2022, 1, 1, 12, 0, 0);
+
+//+ Parses [<days>d]HH:MM:SS[.mmm] into microseconds, false if it is not a time
+static bool parse_time(const char *text, unsigned long long &us)
+{
+  unsigned long days = 0;
+  const char *clock = strchr(text, 'd');
+  if (clock != NULL)
+  {
+    char *end;
+    days = strtoul(text, &end, 10);
+    if (end != clock)
+    {
+      return false;
+    }
+    clock++;
+  }
+  else
+  {
+    clock = text;
+  }
+
+  uint16_t fields[3];
+  char hms[9];
+  const char *dot = strchr(clock, '.');
+  size_t hms_length = dot != NULL ? (size_t)(dot - clock) : strlen(clock);
+  if (hms_length >= sizeof(hms))
+  {
+    return false;
+  }
+  memcpy(hms, clock, hms_length);
+  hms[hms_length] = '\0';
+  if (!parse_fields(hms, ':', fields, 3) || fields[1] > 59 || fields[2] > 59)
+  {
+    return false;
+  }
+
+  uint16_t ms = 0;
+  if (dot != NULL && (strlen(dot + 1) != 3 || !parse_fields(dot + 1, ' ', &ms, 1)))
+  {
+    return false;
+  }
+
+  us = ((days * 86400ULL + fields[0] * 3600ULL + fields[1] * 60ULL + fields[2]) * 1000ULL + ms) * 1000ULL;
+  return true;
+}
+
+//+ Parses an event line (without its time) into event, false if it is not one
+static bool parse_event(char *command, Event &event)
+{
+  char *argument = strtok(command, " \t");
+  char *value = strtok(NULL, " \t");
+  uint16_t number;
+
+  if (argument == NULL)
+  {
+    return false;
+  }
+  if (strcmp(argument, "volts") == 0 || strcmp(argument, "ramp") == 0)
+  {
+    event.type = strcmp(argument, "volts") == 0 ? EVENT_VOLTS : EVENT_RAMP;
+    if (value == NULL || !parse_decivolts(value, number))
+    {
+      return false;
+    }
+    event.counts = counts_at_or_above(number);
+    return event.counts <= VOLT_ADC_MAX;
+  }
+  if (strcmp(argument, "adc") == 0)
+  {
+    event.type = EVENT_ADC;
+    if (value == NULL || !parse_fields(value, ' ', &number, 1) || number > VOLT_ADC_MAX)
+    {
+      return false;
+    }
+    event.counts = number;
+    return true;
+  }
+  if (strcmp(argument, "press") == 0)
+  {
+    event.type = EVENT_PRESS;
+    event.hold_ms = DEFAULT_PRESS_MS;
+    char *hold = strtok(NULL, " \t");
+    if (hold != NULL)
+    {
+      if (!parse_fields(hold, ' ', &number, 1) || number == 0)
+      {
+        return false;
+      }
+      event.hold_ms = number;
+    }
+    for (uint8_t i = 0; value != NULL && i < BUTTON_COUNT; i++)
+    {
+      if (strcmp(value, BUTTONS[i].name) == 0)
+      {
+        event.pin = BUTTONS[i].pin;
+        return true;
+      }
+    }
+    return false;
+  }
+  if (strcmp(argument, "expect") == 0)
+  {
+    event.type = EVENT_EXPECT;
+    char *state = strtok(NULL, " \t");
+    if (value == NULL || strcmp(value, "relay") != 0 || state == NULL || strtok(NULL, " \t") != NULL)
+    {
+      return false;
+    }
+    event.level = strcmp(state, "on") == 0 ? HIGH : LOW;
+    return strcmp(state, "on") == 0 || strcmp(state, "off") == 0;
+  }
+  if (strcmp(argument, "end") == 0)
+  {
+    event.type = EVENT_END;
+    return value == NULL;
+  }
+  return false;
+}
+
+//+ Reads the scenario into events, prints what is wrong and returns false on the first bad line
+static bool load_scenario(FILE *file)
+{
+  char line[LINE_SIZE];
+  int capacity = 0;
+  int number = 0;
+  unsigned long long last_us = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    number++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+    {
+      *comment = '\0';
+    }
+    size_t length = strcspn(line, "\r\n");
+    while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t'))
+    {
+      length--;
+    }
+    line[length] = '\0';
+
+    char *text = line + strspn(line, " \t");
+    if (*text == '\0')
+    {
+      continue;
+    }
+
+    if (strncmp(text, "start ", 6) == 0 || strncmp(text, "drift ", 6) == 0)
+    {
+      uint16_t date[3] = {0, 0, 0};
+      uint16_t time[3] = {0, 0, 0};
+      char *end;
+      bool valid = event_count == 0;
+      if (text[0] == 's')
+      {
+        char day[16];
+        char clock[16];
+        valid = valid && sscanf(text + 6, "%15s %15s", day, clock) == 2 && parse_fields(day, '-', date, 3) &&
+                parse_fields(clock, ':', time, 3) && date[0] >= 2000 && date[0] <= 2099;
+        start_datetime = HalDateTime(valid ? date[0] : 2000, date[1], date[2], time[0], time[1], time[2]);
+        valid = valid && start_datetime.isValid();
+      }
+      else
+      {
+        long ppm = strtol(text + 6, &end, 10);
+        valid = valid && end != text + 6 && *end == '\0';
+        host_set_rtc_drift(ppm);
+      }
+      if (!valid)
+      {
+        fprintf(stderr, "line %d: bad setting, it must come before the events: %s\n", number, text);
+        return false;
+      }
+      continue;
+    }
+
+    if (event_count == capacity)
+    {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      events = (Event *)realloc(events, capacity * sizeof(Event));
+    }
+    Event &event = events[event_count];
+    memset(&event, 0, sizeof(event));
+
+    size_t time_length = strcspn(text, " \t");
+    char *command = text + time_length + strspn(text + time_length, " \t");
+    char time_text[24];
+    bool valid = time_length < sizeof(time_text);
+    if (valid)
+    {
+      memcpy(time_text, text, time_length);
+      time_text[time_length] = '\0';
+      valid = parse_time(time_text, event.at_us);
+    }
+    strcpy(event.text, command);
+
+    if (valid && strncmp(command, "serial ", 7) == 0)
+    {
+      // the console line is sent as written, with its spaces
+      event.type = EVENT_SERIAL;
+      valid = strlen(command + 7) > 0;
+    }
+    else if (valid)
+    {
+      char words[LINE_SIZE];
+      strcpy(words, command);
+      valid = parse_event(words, event);
+    }
+    if (!valid)
+    {
+      fprintf(stderr, "line %d: bad event: %s\n", number, text);
+      return false;
+    }
+    if (event.at_us < last_us)
+    {
+      fprintf(stderr, "line %d: event before the one above it: %s\n", number, text);
+      return false;
+    }
+    last_us = event.at_us;
+    event_count++;
+  }
+  return true;
+}
+
+//+ Prints the start of a timeline line: the datetime of the virtual time (not of the drifting RTC)
+static void print_time()
+{
+  unsigned long long now_us = host_time_us();
+  HalDateTime now = HalDateTime::from_seconds(start_datetime.seconds() + (uint32_t)(now_us / 1000000));
+  printf("%04u-%02u-%02u %02u:%02u:%02u.%03u  ", now.year(), now.month(), now.day(), now.hour(), now.minute(),
+         now.second(), (unsigned)(now_us / 1000 % 1000));
+}
+
+/* What the timeline has shown of the firmware so far */
+static bool show_lcd = false;
+static uint8_t relay = LOW;
+static unsigned long relay_switches = 0;
+static unsigned long long relay_on_us = 0;
+static unsigned long long relay_since_us = 0;
+static char frame[2][LCD_VISIBLE_COLS + 1] = {"", ""};
+
+//+ Prints the console lines, the relay transition and the LCD frame that came since the last call. Runs after every
+// pass and at the start of every power down, so what a pass did is stamped with the time before it went to sleep.
+static void record_changes()
+{
+  char line[LINE_SIZE];
+  while (host_serial_line(line, sizeof(line)))
+  {
+    print_time();
+    printf("serial %s\n", line);
+  }
+
+  uint8_t level = host_get_pin(RELAY_PIN);
+  if (level != relay)
+  {
+    relay = level;
+    relay_switches++;
+    if (level == HIGH)
+    {
+      relay_since_us = host_time_us();
+    }
+    else
+    {
+      relay_on_us += host_time_us() - relay_since_us;
+    }
+    print_time();
+    printf("relay %s\n", level == HIGH ? "on" : "off");
+  }
+
+  if (show_lcd && (strcmp(frame[0], host_lcd_row(0)) != 0 || strcmp(frame[1], host_lcd_row(1)) != 0))
+  {
+    strcpy(frame[0], host_lcd_row(0));
+    strcpy(frame[1], host_lcd_row(1));
+    print_time();
+    printf("lcd [%s][%s]\n", frame[0], frame[1]);
+  }
+}
+
+//+ The A0 reading at the virtual time: the last voltage event, or the slope towards the next one if that is a ramp
+static int adc_counts_at(unsigned long long now_us, int &last_volt)
+{
+  while (true)
+  {
+    int next = last_volt + 1;
+    while (next < event_count && events[next].type != EVENT_VOLTS && events[next].type != EVENT_RAMP &&
+           events[next].type != EVENT_ADC)
+    {
+      next++;
+    }
+    if (next == event_count)
+    {
+      return last_volt < 0 ? 0 : events[last_volt].counts;
+    }
+    if (events[next].at_us <= now_us)
+    {
+      last_volt = next;
+      continue;
+    }
+    if (last_volt < 0)
+    {
+      return 0;
+    }
+
+    const Event &from = events[last_volt];
+    const Event &to = events[next];
+    if (to.type != EVENT_RAMP)
+    {
+      return from.counts;
+    }
+    long long span_us = to.at_us - from.at_us;
+    long long into_us = now_us - from.at_us;
+    return from.counts + (int)((to.counts - from.counts) * into_us / span_us);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s <scenario file, - for stdin> [-l]\n", argv[0]);
+    return 2;
+  }
+  show_lcd = argc > 2 && strcmp(argv[2], "-l") == 0;
+
+  FILE *file = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+  if (file == NULL)
+  {
+    fprintf(stderr, "cannot open %s\n", argv[1]);
+    return 2;
+  }
+  bool loaded = load_scenario(file);
+  if (file != stdin)
+  {
+    fclose(file);
+  }
+  if (!loaded)
+  {
+    return 2;
+  }
+  if (event_count == 0)
+  {
+    fprintf(stderr, "the scenario has no events\n");
+    return 2;
+  }
+
+  unsigned long long end_us = events[event_count - 1].at_us;
+  for (int i = 0; i < event_count; i++)
+  {
+    if (events[i].type == EVENT_END)
+    {
+      end_us = events[i].at_us;
+      break;
+    }
+  }
+
+  host_capture_serial(true);
+  host_set_datetime(start_datetime);
+  int last_volt = -1;
+  host_set_adc(VOLTAGE_PIN, adc_counts_at(0, last_volt));
+
+  host_on_power_down(record_changes);
+  setup();
+
+  int next_event = 0;
+  int next_press = 0;
+  bool press_down = false; // the press of next_press is scheduled, its release is not yet
+  unsigned long passes = 0;
+  unsigned long failed = 0;
+  relay = host_get_pin(RELAY_PIN);
+  char line[LINE_SIZE];
+
+  while (true)
+  {
+    unsigned long long now_us = host_time_us();
+
+    // the presses go ahead of time, as a pin change is what ends a power down
+    while (next_press < event_count && events[next_press].at_us <= now_us + PRESS_LOOKAHEAD_US)
+    {
+      const Event &event = events[next_press];
+      if (event.type == EVENT_PRESS)
+      {
+        // a full queue of changes takes the rest on a later pass
+        unsigned long delay_us = event.at_us > now_us ? (unsigned long)(event.at_us - now_us) : 0;
+        if (!press_down && !host_set_pin_at(event.pin, HIGH, delay_us))
+        {
+          break;
+        }
+        press_down = true;
+        if (!host_set_pin_at(event.pin, LOW, delay_us + event.hold_ms * 1000))
+        {
+          break;
+        }
+        press_down = false;
+      }
+      next_press++;
+    }
+
+    while (next_event < event_count && events[next_event].at_us <= now_us)
+    {
+      const Event &event = events[next_event++];
+      print_time();
+      printf("> %s\n", event.text);
+      if (event.type == EVENT_SERIAL)
+      {
+        snprintf(line, sizeof(line), "%s\n", event.text + 7);
+        if (!host_serial_input(line))
+        {
+          print_time();
+          printf("! serial input overflowed\n");
+        }
+      }
+      else if (event.type == EVENT_EXPECT && host_get_pin(RELAY_PIN) != event.level)
+      {
+        failed++;
+        print_time();
+        printf("! expected the relay %s\n", event.level == HIGH ? "on" : "off");
+      }
+    }
+    if (now_us >= end_us)
+    {
+      break;
+    }
+
+    host_set_adc(VOLTAGE_PIN, adc_counts_at(now_us, last_volt));
+
+    loop();
+    host_advance_us(LOOP_OVERHEAD_US);
+    passes++;
+
+    record_changes();
+  }
+
+  if (relay == HIGH)
+  {
+    relay_on_us += host_time_us() - relay_since_us;
+  }
+  unsigned long long asleep_us = host_asleep_us();
+  printf("simulated %.3fs in %lu loop passes: relay switched %lu times, on %.3fs, powered down %.3fs, "
+         "%lu LCD writes, %lu EEPROM writes\n",
+         end_us / 1e6, passes, relay_switches, relay_on_us / 1e6, asleep_us / 1e6, host_lcd_writes(),
+         host_eeprom_writes());
+  if (failed > 0)
+  {
+    printf("%lu expectations failed\n", failed);
+  }
+
+  free(events);
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+/*
+*Overview: Implementation of the RTC disciplined software clock.
+*/
+
+#include "soft_clock.h"
+
+/* How often the clock is re-synced with the RTC (in milliseconds) */
+static const uint32_t SYNC_INTERVAL_MS = 60000;
+
+/* How long before the predicted RTC edge the search starts, before and after the drift is known */
+static const uint32_t SYNC_LEAD_UNTRIMMED_MS = 500;
+static const uint32_t SYNC_LEAD_MS = 20;
+
+/* Give up on the edge search after this long (the RTC is stopped or missing) */
+static const unsigned long SYNC_TIMEOUT_MS = 1100;
+
+/* The phase of a trimmed clock is taken to be out by this much, plus 1ms for every second since the last edge */
+static const uint16_t EDGE_GUARD_MS = 2;
+
+/* Rates beyond this are treated as bad readings, the Uno resonator is good to about 0.5% */
+static const int32_t MAX_DRIFT_PPM = 20000;
+
+SoftClock::SoftClock()
+{
+  rtc = NULL;
+  base_seconds = 0;
+  base_ms = 0;
+  synced_ms = 0;
+  on_tick = false;
+  drift = 0;
+  is_trimmed = false;
+  is_locked = false;
+  syncing = false;
+  sync_start_ms = 0;
+  sync_second = 0;
+  cached_seconds = 0xFFFFFFFF;
+}
+
+void SoftClock::begin(HalClock &clock)
+{
+  rtc = &clock;
+
+  unsigned long now_ms = hal_millis();
+  HalDateTime dt = rtc->now();
+
+  // good to within a second until the first edge is seen
+  base_seconds = dt.seconds();
+  base_ms = now_ms;
+  mark_synced();
+  is_locked = false;
+  cached_seconds = 0xFFFFFFFF;
+
+  syncing = true;
+  sync_start_ms = now_ms;
+  sync_second = dt.second();
+}
+
+uint32_t SoftClock::elapsed_ms(unsigned long now_ms) const
+{
+  return corrected(now_ms - base_ms);
+}
+
+uint32_t SoftClock::corrected(uint32_t raw_ms) const
+{
+  // the correction is worked out per whole second so it stays within 32 bits
+  int32_t correction = (int32_t)(raw_ms / 1000) * drift / 1000;
+
+  return raw_ms + correction;
+}
+
+uint32_t SoftClock::seconds()
+{
+  return base_seconds + elapsed_ms(hal_millis()) / 1000;
+}
+
+HalDateTime SoftClock::now()
+{
+  uint32_t now_seconds = seconds();
+
+  if (now_seconds != cached_seconds)
+  {
+    cached = HalDateTime::from_seconds(now_seconds);
+    cached_seconds = now_seconds;
+  }
+  return cached;
+}
+
+void SoftClock::adjust(const HalDateTime &dt)
+{
+  if (rtc != NULL)
+  {
+    rtc->adjust(dt);
+  }
+
+  // the DS1307 restarts its seconds count when written, so lock on to the next edge again
+  unsigned long now_ms = hal_millis();
+  base_seconds = dt.seconds();
+  base_ms = now_ms;
+  mark_synced();
+  is_locked = false;
+  cached_seconds = 0xFFFFFFFF;
+
+  syncing = rtc != NULL;
+  sync_start_ms = now_ms;
+  sync_second = dt.second();
+}
+
+uint16_t SoftClock::ms_to_edge(unsigned long now_ms) const
+{
+  if (!is_locked || !is_trimmed || syncing)
+  {
+    return 0;
+  }
+
+  uint32_t elapsed = elapsed_ms(now_ms);
+  uint32_t guard = EDGE_GUARD_MS + elapsed / 1000;
+  uint32_t into_second = elapsed % 1000;
+
+  if (into_second < guard || 1000 - into_second < guard)
+  {
+    return 0;
+  }
+  return 1000 - into_second;
+}
+
+void SoftClock::second_edge(unsigned long now_ms, uint32_t second)
+{
+  // millis() was only moved on by an estimate while powered down, so the edge becomes the base; the sync is still due
+  // a minute after the last one, as a missed or glitched tick is only put right by reading the RTC
+  base_seconds = second;
+  base_ms = now_ms;
+  on_tick = true;
+}
+
+void SoftClock::resync(unsigned long now_ms)
+{
+  if (rtc == NULL)
+  {
+    return;
+  }
+
+  // the base is out by the time millis() missed, so no drift is measured from it
+  rebase(now_ms);
+  mark_synced();
+  is_locked = false;
+  start_sync(now_ms);
+}
+
+void SoftClock::start_sync(unsigned long now_ms)
+{
+  syncing = true;
+  sync_start_ms = now_ms;
+  sync_second = rtc->now().second();
+}
+
+void SoftClock::rebase(unsigned long now_ms)
+{
+  // moves the base up to now while keeping the phase of the seconds
+  uint32_t elapsed = elapsed_ms(now_ms);
+  base_seconds += elapsed / 1000;
+  base_ms = now_ms - elapsed % 1000;
+}
+
+void SoftClock::mark_synced()
+{
+  synced_ms = base_ms;
+  on_tick = false;
+}
+
+void SoftClock::update(unsigned long now_ms)
+{
+  if (rtc == NULL)
+  {
+    return;
+  }
+
+  if (!syncing)
+  {
+    // the search starts just before the corrected time reaches the next sync point, which the ticks of a power down
+    // do not move
+    uint32_t lead = is_trimmed ? SYNC_LEAD_MS : SYNC_LEAD_UNTRIMMED_MS;
+    if (corrected(now_ms - synced_ms) + lead < SYNC_INTERVAL_MS)
+    {
+      return;
+    }
+
+    // after a square wave tick the base already is an edge and the RTC only has to confirm its second, with one read
+    // once clear of the edge instead of staying awake for the search
+    uint32_t elapsed = elapsed_ms(now_ms);
+    if (on_tick && elapsed < EDGE_GUARD_MS)
+    {
+      return;
+    }
+    if (on_tick && elapsed < 1000 - EDGE_GUARD_MS)
+    {
+      base_seconds = rtc->now().seconds();
+      synced_ms = now_ms;
+      return;
+    }
+    start_sync(now_ms);
+    return;
+  }
+
+  HalDateTime dt = rtc->now();
+
+  if (dt.second() != sync_second)
+  {
+    // the RTC has just ticked over, so this is the start of an RTC second
+    uint32_t rtc_seconds = dt.seconds();
+    int32_t raw_elapsed = now_ms - base_ms;
+
+    if (is_locked && raw_elapsed >= 1000)
+    {
+      int32_t rtc_elapsed = (int32_t)(rtc_seconds - base_seconds) * 1000;
+      int32_t difference = rtc_elapsed - raw_elapsed;
+
+      // differences of more than 5% come from the RTC being set, not from drift
+      if (difference < raw_elapsed / 20 && difference > -raw_elapsed / 20)
+      {
+        int32_t measured = difference * 1000 / (raw_elapsed / 1000);
+
+        if (measured > MAX_DRIFT_PPM)
+        {
+          measured = MAX_DRIFT_PPM;
+        }
+        else if (measured < -MAX_DRIFT_PPM)
+        {
+          measured = -MAX_DRIFT_PPM;
+        }
+
+        // the first measurement is taken as is, later ones are smoothed
+        drift = is_trimmed ? (3 * drift + measured) / 4 : measured;
+        is_trimmed = true;
+      }
+    }
+
+    base_seconds = rtc_seconds;
+    base_ms = now_ms;
+    mark_synced();
+    is_locked = true;
+    syncing = false;
+  }
+  else if (now_ms - sync_start_ms > SYNC_TIMEOUT_MS)
+  {
+    // the RTC is not ticking, carry on with the software time and try again next interval
+    syncing = false;
+    rebase(now_ms);
+    mark_synced();
+  }
+}
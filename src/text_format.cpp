@@ -0,0 +1,157 @@
+/*
+*Overview: Implementation of the fixed size text helpers.
+*/
+
+#include "text_format.h"
+
+void format_uint(char *dst, uint16_t value, uint8_t width)
+{
+  dst[width] = '\0';
+  while (width > 0)
+  {
+    dst[--width] = digit_char(value % 10);
+    value /= 10;
+  }
+}
+
+void format_time_digits(char *dst, const int *digits)
+{
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    dst[i] = digit_char(digits[i]);
+  }
+  dst[4] = '\0';
+}
+
+void format_volt_digits(char *dst, const int *digits)
+{
+  dst[0] = digit_char(digits[0]);
+  dst[1] = digit_char(digits[1]);
+  dst[2] = '.';
+  dst[3] = digit_char(digits[3]);
+  dst[4] = '\0';
+}
+
+void format_decivolts(char *dst, uint16_t decivolts)
+{
+  format_uint(dst, decivolts / 10, 2);
+  dst[2] = '.';
+  dst[3] = digit_char(decivolts % 10);
+  dst[4] = '\0';
+}
+
+/* The letters of the days of the week from Sunday */
+static const char DAY_LETTERS[] = "SMTWTFS";
+
+void format_days(char *dst, uint8_t days)
+{
+  for (uint8_t day = 0; day < 7; day++)
+  {
+    dst[day] = (days >> day) & 1 ? DAY_LETTERS[day] : '-';
+  }
+  dst[7] = '\0';
+}
+
+bool parse_days(const char *str, uint8_t &days)
+{
+  uint8_t mask = 0;
+  for (uint8_t day = 0; day < 7; day++)
+  {
+    // lower case letters are taken as well
+    char c = str[day] >= 'a' && str[day] <= 'z' ? str[day] - 'a' + 'A' : str[day];
+    if (c == DAY_LETTERS[day])
+    {
+      mask |= 1 << day;
+    }
+    else if (c != '-')
+    {
+      return false;
+    }
+  }
+  if (str[7] != '\0')
+  {
+    return false;
+  }
+  days = mask;
+  return true;
+}
+
+int parse_digits(const char *str)
+{
+  int value = 0;
+  for (; *str != '\0'; str++)
+  {
+    if (*str >= '0' && *str <= '9')
+    {
+      value = value * 10 + (*str - '0');
+    }
+  }
+  return value;
+}
+
+bool parse_fields(const char *str, char separator, uint16_t *fields, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint32_t value = 0;
+    uint8_t digits = 0;
+    for (; *str >= '0' && *str <= '9'; str++)
+    {
+      value = value * 10 + (*str - '0');
+      if (++digits > 5 || value > 0xFFFF)
+      {
+        return false;
+      }
+    }
+    if (digits == 0)
+    {
+      return false;
+    }
+    fields[i] = value;
+
+    // each field but the last is followed by the separator, the last one by the end
+    if (*str != (i + 1 < count ? separator : '\0'))
+    {
+      return false;
+    }
+    str++;
+  }
+  return true;
+}
+
+bool parse_decivolts(const char *str, uint16_t &decivolts)
+{
+  uint16_t fields[2];
+  if (parse_fields(str, '.', fields, 1) && fields[0] < 6554)
+  {
+    decivolts = fields[0] * 10;
+    return true;
+  }
+
+  // a single digit after the point, "12.50" would otherwise read as 17.0V
+  const char *point = str;
+  while (*point != '\0' && *point != '.')
+  {
+    point++;
+  }
+  if (*point != '.' || point[1] == '\0' || point[2] != '\0')
+  {
+    return false;
+  }
+  if (!parse_fields(str, '.', fields, 2) || fields[0] >= 6553)
+  {
+    return false;
+  }
+  decivolts = fields[0] * 10 + fields[1];
+  return true;
+}
+
+void copy_text(char *dst, const char *src, uint8_t size)
+{
+  uint8_t i = 0;
+  for (; i + 1 < size && src[i] != '\0'; i++)
+  {
+    dst[i] = src[i];
+  }
+  dst[i] = '\0';
+}
@@ -0,0 +1,36 @@
+/*
+*Overview: Conversion of the voltage alarm thresholds into ADC counts.
+*/
+
+#include "volt_fixed.h"
+
+//+ The lowest ADC reading whose voltage is at or above decivolts (binary search, the conversion is monotonic)
+int16_t counts_at_or_above(uint16_t decivolts)
+{
+  int16_t low = 0;
+  int16_t high = VOLT_ADC_MAX + 1;
+
+  while (low < high)
+  {
+    int16_t middle = (low + high) / 2;
+    if (counts_to_decivolts(middle) >= decivolts)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
+    }
+  }
+  return low;
+}
+
+int16_t counts_at_or_below(uint16_t decivolts)
+{
+  // one below the first reading that is above the voltage
+  if (decivolts == 0xFFFF)
+  {
+    return VOLT_ADC_MAX;
+  }
+  return counts_at_or_above(decivolts + 1) - 1;
+}
@@ -0,0 +1,276 @@
+/*
+*Overview: Unit tests of the minute of the day schedule of the time alarms (run with `pio test -e native`): windows
+*          that wrap past midnight, ON equal to OFF for 24 hours, weekday masks across midnight, the relay changes
+*          check() reports and the next event the menu shows.
+*/
+
+#include <unity.h>
+
+#include "../../src/alarm_table.cpp"
+
+/* Weekdays as numbered by HalDateTime::dayOfTheWeek() */
+#define SUNDAY 0
+#define FRIDAY 5
+#define SATURDAY 6
+
+static AlarmTable table;
+
+//+ Adds an alarm to the schedule of weekday the way the firmware does, from its weekday mask (bit n is weekday n)
+static void add_on_day(int on_hhmm, int off_hhmm, uint8_t days, uint8_t weekday)
+{
+  uint8_t yesterday = weekday == SUNDAY ? SATURDAY : weekday - 1;
+  table.add(hhmm_to_minute(on_hhmm), hhmm_to_minute(off_hhmm), days & (1 << weekday), days & (1 << yesterday));
+}
+
+//+ Checks that the relay is wanted ON exactly from the minute from_hhmm up to the minute before to_hhmm
+static void assert_on_between(int from_hhmm, int to_hhmm)
+{
+  uint16_t from = hhmm_to_minute(from_hhmm);
+  uint16_t to = hhmm_to_minute(to_hhmm);
+  for (uint16_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+  {
+    TEST_ASSERT_EQUAL_MESSAGE(minute >= from && minute < to, table.relay_on_at(minute), "wrong state at a minute");
+  }
+}
+
+//+ Checks that the relay is never wanted ON
+static void assert_always_off()
+{
+  for (uint16_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+  {
+    TEST_ASSERT_FALSE(table.relay_on_at(minute));
+  }
+}
+
+void setUp()
+{
+  table = AlarmTable();
+}
+
+void tearDown()
+{
+}
+
+void test_hhmm_conversion()
+{
+  TEST_ASSERT_EQUAL(0, hhmm_to_minute(0));
+  TEST_ASSERT_EQUAL(390, hhmm_to_minute(630));
+  TEST_ASSERT_EQUAL(1439, hhmm_to_minute(2359));
+  TEST_ASSERT_EQUAL(2359, minute_to_hhmm(1439));
+  TEST_ASSERT_EQUAL(715, minute_to_hhmm(435));
+}
+
+void test_window_within_the_day()
+{
+  table.add(hhmm_to_minute(630), hhmm_to_minute(715), true, true);
+  assert_on_between(630, 715);
+  TEST_ASSERT_EQUAL(1, table.size());
+}
+
+void test_window_not_run_today_is_off()
+{
+  // a window within the day has nothing to carry on from yesterday
+  table.add(hhmm_to_minute(630), hhmm_to_minute(715), false, true);
+  assert_always_off();
+  TEST_ASSERT_EQUAL(1, table.size());
+}
+
+void test_overnight_window_starting_today()
+{
+  table.add(hhmm_to_minute(2200), hhmm_to_minute(600), true, false);
+  assert_on_between(2200, 2400);
+}
+
+void test_overnight_window_carried_from_yesterday()
+{
+  table.add(hhmm_to_minute(2200), hhmm_to_minute(600), false, true);
+  assert_on_between(0, 600);
+}
+
+void test_overnight_window_every_day()
+{
+  table.add(hhmm_to_minute(2200), hhmm_to_minute(600), true, true);
+  for (uint16_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+  {
+    bool on = minute < hhmm_to_minute(600) || minute >= hhmm_to_minute(2200);
+    TEST_ASSERT_EQUAL(on, table.relay_on_at(minute));
+  }
+}
+
+void test_window_ending_at_midnight()
+{
+  table.add(hhmm_to_minute(2300), 0, true, true);
+  assert_on_between(2300, 2400);
+}
+
+void test_on_equal_to_off_is_24_hours()
+{
+  // ON at 08:00 today up to 08:00 tomorrow
+  table.add(hhmm_to_minute(800), hhmm_to_minute(800), true, false);
+  assert_on_between(800, 2400);
+
+  table.clear();
+  table.add(hhmm_to_minute(800), hhmm_to_minute(800), false, true);
+  assert_on_between(0, 800);
+
+  table.clear();
+  table.add(hhmm_to_minute(800), hhmm_to_minute(800), true, true);
+  assert_on_between(0, 2400);
+}
+
+void test_overlapping_windows_are_merged()
+{
+  table.add(hhmm_to_minute(600), hhmm_to_minute(700), true, true);
+  table.add(hhmm_to_minute(645), hhmm_to_minute(801), true, true);
+  assert_on_between(600, 801);
+  TEST_ASSERT_EQUAL(2, table.size());
+}
+
+void test_clear_removes_the_alarms()
+{
+  table.add(hhmm_to_minute(600), hhmm_to_minute(700), true, true);
+  table.clear();
+  assert_always_off();
+  TEST_ASSERT_EQUAL(0, table.size());
+}
+
+void test_weekday_mask_across_midnight()
+{
+  // a Friday night alarm runs from Friday 22:00 to Saturday 02:00 and not at all on Sunday
+  uint8_t fridays = 1 << FRIDAY;
+
+  add_on_day(2200, 200, fridays, FRIDAY);
+  assert_on_between(2200, 2400);
+
+  table.clear();
+  add_on_day(2200, 200, fridays, SATURDAY);
+  assert_on_between(0, 200);
+
+  table.clear();
+  add_on_day(2200, 200, fridays, SUNDAY);
+  assert_always_off();
+}
+
+void test_weekday_mask_across_the_week_end()
+{
+  // a Saturday night alarm carries on into Sunday, the day after Saturday wraps to weekday 0
+  add_on_day(2330, 30, 1 << SATURDAY, SUNDAY);
+  assert_on_between(0, 30);
+}
+
+void test_check_reports_changes_only()
+{
+  bool relay_on = true;
+  table.add(hhmm_to_minute(630), hhmm_to_minute(715), true, true);
+
+  // the first check always reports, an empty or OFF minute included
+  TEST_ASSERT_TRUE(table.check(hhmm_to_minute(600), relay_on));
+  TEST_ASSERT_FALSE(relay_on);
+  TEST_ASSERT_FALSE(table.check(hhmm_to_minute(601), relay_on));
+
+  TEST_ASSERT_TRUE(table.check(hhmm_to_minute(630), relay_on));
+  TEST_ASSERT_TRUE(relay_on);
+  TEST_ASSERT_FALSE(table.check(hhmm_to_minute(700), relay_on));
+
+  // a missed edge is caught on the next check
+  TEST_ASSERT_TRUE(table.check(hhmm_to_minute(900), relay_on));
+  TEST_ASSERT_FALSE(relay_on);
+
+  table.resync();
+  TEST_ASSERT_TRUE(table.check(hhmm_to_minute(900), relay_on));
+  TEST_ASSERT_FALSE(relay_on);
+}
+
+void test_check_after_clear_keeps_the_reported_state()
+{
+  bool relay_on = false;
+  table.add(hhmm_to_minute(600), hhmm_to_minute(800), true, true);
+  TEST_ASSERT_TRUE(table.check(hhmm_to_minute(700), relay_on));
+  TEST_ASSERT_TRUE(relay_on);
+
+  // a new schedule that still wants the relay ON does not report it again
+  table.clear();
+  table.add(hhmm_to_minute(630), hhmm_to_minute(730), true, true);
+  TEST_ASSERT_FALSE(table.check(hhmm_to_minute(700), relay_on));
+
+  // deleting the last alarm reports OFF
+  table.clear();
+  TEST_ASSERT_TRUE(table.check(hhmm_to_minute(700), relay_on));
+  TEST_ASSERT_FALSE(relay_on);
+}
+
+void test_next_event()
+{
+  AlarmEvent event;
+  table.add(hhmm_to_minute(630), hhmm_to_minute(715), true, true);
+
+  TEST_ASSERT_TRUE(table.next_event(0, event));
+  TEST_ASSERT_EQUAL(hhmm_to_minute(630), event.minute);
+  TEST_ASSERT_TRUE(event.relay_on);
+
+  TEST_ASSERT_TRUE(table.next_event(hhmm_to_minute(630), event));
+  TEST_ASSERT_EQUAL(hhmm_to_minute(715), event.minute);
+  TEST_ASSERT_FALSE(event.relay_on);
+
+  // after the last change of the day the schedule wraps to the next morning
+  TEST_ASSERT_TRUE(table.next_event(hhmm_to_minute(2000), event));
+  TEST_ASSERT_EQUAL(hhmm_to_minute(630), event.minute);
+  TEST_ASSERT_TRUE(event.relay_on);
+
+  TEST_ASSERT_TRUE(table.next_event(MINUTES_PER_DAY - 1, event));
+  TEST_ASSERT_EQUAL(hhmm_to_minute(630), event.minute);
+}
+
+void test_next_event_at_every_minute()
+{
+  // compared with a minute by minute search, at edges that are and are not on a byte boundary
+  AlarmEvent event;
+  table.add(hhmm_to_minute(1), hhmm_to_minute(9), true, true);
+  table.add(hhmm_to_minute(1203), hhmm_to_minute(1204), true, true);
+  table.add(hhmm_to_minute(2330), hhmm_to_minute(100), true, false);
+
+  for (uint16_t now = 0; now < MINUTES_PER_DAY; now++)
+  {
+    uint16_t expected = now;
+    do
+    {
+      expected = expected + 1 == MINUTES_PER_DAY ? 0 : expected + 1;
+    } while (table.relay_on_at(expected) == table.relay_on_at(now));
+
+    TEST_ASSERT_TRUE(table.next_event(now, event));
+    TEST_ASSERT_EQUAL(expected, event.minute);
+    TEST_ASSERT_EQUAL(!table.relay_on_at(now), event.relay_on);
+  }
+}
+
+void test_next_event_without_changes()
+{
+  AlarmEvent event;
+  TEST_ASSERT_FALSE(table.next_event(hhmm_to_minute(1200), event));
+
+  table.add(hhmm_to_minute(800), hhmm_to_minute(800), true, true);
+  TEST_ASSERT_FALSE(table.next_event(hhmm_to_minute(1200), event));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_hhmm_conversion);
+  RUN_TEST(test_window_within_the_day);
+  RUN_TEST(test_window_not_run_today_is_off);
+  RUN_TEST(test_overnight_window_starting_today);
+  RUN_TEST(test_overnight_window_carried_from_yesterday);
+  RUN_TEST(test_overnight_window_every_day);
+  RUN_TEST(test_window_ending_at_midnight);
+  RUN_TEST(test_on_equal_to_off_is_24_hours);
+  RUN_TEST(test_overlapping_windows_are_merged);
+  RUN_TEST(test_clear_removes_the_alarms);
+  RUN_TEST(test_weekday_mask_across_midnight);
+  RUN_TEST(test_weekday_mask_across_the_week_end);
+  RUN_TEST(test_check_reports_changes_only);
+  RUN_TEST(test_check_after_clear_keeps_the_reported_state);
+  RUN_TEST(test_next_event);
+  RUN_TEST(test_next_event_at_every_minute);
+  RUN_TEST(test_next_event_without_changes);
+  return UNITY_END();
+}
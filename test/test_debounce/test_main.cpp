@@ -0,0 +1,178 @@
+/*
+*Overview: Unit tests of the button debouncing (run with `pio test -e native`). Bounce patterns are fed through the
+*          vertical counters one sample every HAL_INPUT_SAMPLE_MS, the way the timer interrupt of the HAL does, and
+*          the debounced changes into the button events, which have to hold exactly one press and one release per
+*          push of a button however much its contacts bounce.
+*/
+
+#include <unity.h>
+
+#include "hal.h"
+#include "vertical_debounce.h"
+#include "../../src/button_input.cpp"
+
+/* Button pins as on the Uno, where bit n of the sampled levels is pin n of PORTD */
+#define PIN_UP 2
+#define PIN_SELECT 6
+#define PIN_MASK (1 << PIN_UP | 1 << PIN_SELECT)
+
+static VerticalDebounce debounce;
+static ButtonInput input;
+static unsigned long now_ms;
+
+/* Time of the event last taken by expect_event() */
+static unsigned long event_ms;
+
+//+ Feeds one sample of the raw pin levels, a debounced change goes to the button events with the time of the sample
+static void sample(uint8_t raw)
+{
+  now_ms += HAL_INPUT_SAMPLE_MS;
+  if (debounce.sample(raw) != 0)
+  {
+    input.sample(debounce.levels(), now_ms);
+  }
+}
+
+//+ Feeds the samples of pattern, '1' for the pin HIGH (pressed) and '0' for LOW, every other pin LOW
+static void feed(uint8_t pin, const char *pattern)
+{
+  for (; *pattern != '\0'; pattern++)
+  {
+    sample(*pattern == '1' ? 1 << pin : 0);
+  }
+}
+
+//+ Feeds count samples of the same levels
+static void hold(uint8_t raw, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    sample(raw);
+  }
+}
+
+//+ Takes the next event and checks it is a press or release of pin
+static void expect_event(uint8_t pin, bool pressed)
+{
+  input.update(now_ms);
+  input.pressed(event_ms);
+  TEST_ASSERT_EQUAL_MESSAGE(pressed, input.rose(pin), "wrong press");
+  TEST_ASSERT_EQUAL_MESSAGE(!pressed, input.fell(pin), "wrong release");
+}
+
+//+ Checks that no event is left
+static void expect_no_event()
+{
+  unsigned long time_ms;
+  input.update(now_ms);
+  TEST_ASSERT_FALSE(input.rose(PIN_UP) || input.fell(PIN_UP) || input.rose(PIN_SELECT) || input.fell(PIN_SELECT));
+  TEST_ASSERT_FALSE(input.pressed(time_ms));
+}
+
+void setUp()
+{
+  now_ms = 1000;
+  debounce.begin(0);
+  input.begin(PIN_MASK, 0, now_ms);
+}
+
+void tearDown()
+{
+}
+
+void test_clean_press_and_release()
+{
+  unsigned long start_ms = now_ms;
+  hold(1 << PIN_UP, 20);
+  hold(0, 20);
+
+  // each edge is debounced on the 8th sample that holds the new level
+  expect_event(PIN_UP, true);
+  TEST_ASSERT_EQUAL(start_ms + VerticalDebounce::SAMPLES * HAL_INPUT_SAMPLE_MS, event_ms);
+  expect_event(PIN_UP, false);
+  TEST_ASSERT_EQUAL(start_ms + (20 + VerticalDebounce::SAMPLES) * HAL_INPUT_SAMPLE_MS, event_ms);
+  expect_no_event();
+  TEST_ASSERT_TRUE(debounce.idle());
+}
+
+void test_bouncing_press_gives_one_event()
+{
+  // the contacts bounce for about 40ms on the way in and out
+  unsigned long start_ms = now_ms;
+  feed(PIN_UP, "1011010011110111111111111111111");
+  feed(PIN_UP, "0100101100000000000000");
+
+  // the press is debounced 8 samples after the last bounce (the 13th sample)
+  expect_event(PIN_UP, true);
+  TEST_ASSERT_EQUAL(start_ms + (13 + VerticalDebounce::SAMPLES) * HAL_INPUT_SAMPLE_MS, event_ms);
+  expect_event(PIN_UP, false);
+  expect_no_event();
+  TEST_ASSERT_EQUAL(0, input.overflows());
+}
+
+void test_short_glitches_are_ignored()
+{
+  // up to 7 samples in a row are not enough, however often they come
+  feed(PIN_UP, "1111111011111110111111101111111000000001111111");
+  hold(0, 10);
+  expect_no_event();
+  TEST_ASSERT_EQUAL(0, debounce.levels());
+}
+
+void test_glitch_while_held_is_ignored()
+{
+  hold(1 << PIN_UP, 10);
+  feed(PIN_UP, "0000000111111101");
+  hold(1 << PIN_UP, 10);
+  expect_event(PIN_UP, true);
+  expect_no_event();
+  TEST_ASSERT_TRUE(debounce.levels() & 1 << PIN_UP);
+}
+
+void test_shortest_press()
+{
+  feed(PIN_UP, "11111111");
+  hold(0, 8);
+  expect_event(PIN_UP, true);
+  expect_event(PIN_UP, false);
+  expect_no_event();
+}
+
+void test_two_buttons_bouncing_together()
+{
+  // select settles two samples after up, both are seen in the order they settled
+  static const char up[] = "101111111111111111110101000000000000";
+  static const char select[] = "100011111111111111111111100000000000";
+  for (uint8_t i = 0; up[i] != '\0'; i++)
+  {
+    sample((up[i] == '1' ? 1 << PIN_UP : 0) | (select[i] == '1' ? 1 << PIN_SELECT : 0));
+  }
+
+  expect_event(PIN_UP, true);
+  unsigned long up_pressed = event_ms;
+  expect_event(PIN_SELECT, true);
+  TEST_ASSERT_EQUAL(2 * HAL_INPUT_SAMPLE_MS, event_ms - up_pressed);
+  expect_event(PIN_UP, false);
+  expect_event(PIN_SELECT, false);
+  expect_no_event();
+}
+
+void test_pins_outside_the_mask_are_ignored()
+{
+  // pin 3 is debounced like the others but is not a button
+  hold(1 << 3, 20);
+  expect_no_event();
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_clean_press_and_release);
+  RUN_TEST(test_bouncing_press_gives_one_event);
+  RUN_TEST(test_short_glitches_are_ignored);
+  RUN_TEST(test_glitch_while_held_is_ignored);
+  RUN_TEST(test_shortest_press);
+  RUN_TEST(test_two_buttons_bouncing_together);
+  RUN_TEST(test_pins_outside_the_mask_are_ignored);
+  return UNITY_END();
+}
@@ -0,0 +1,340 @@
+/*
+*Overview: Unit tests of the EEPROM record log (run with `pio test -e native`). The log runs on a fake EEPROM that
+*          can lose power after any number of written bytes; every test of a power cut replays the same write with
+*          the cut moved one byte further each time, then starts a new log on what was left as if the relay had
+*          rebooted, and checks that every key still reads either its old or its new data.
+*/
+
+#include <string.h>
+#include <unity.h>
+
+#include "../../src/ee_journal.cpp"
+
+/* A small log, 16 slots per bank, so a few dozen writes go through both banks */
+#define LOG_START 16
+#define LOG_SLOTS 16
+#define LOG_SIZE (EeJournal::WEAR_SIZE + 2 * LOG_SLOTS * EeJournal::RECORD_SIZE)
+
+/* Keys written by the tests, a compaction copies all of them */
+#define KEYS 6
+
+static_assert(KEYS <= EeJournal::MAX_KEYS, "the tests write more keys than the log holds");
+
+/* The fake EEPROM, blank like a new Uno */
+static uint8_t eeprom[LOG_START + LOG_SIZE];
+
+/* Bytes written before the power is cut, or -1 to never cut it */
+static long bytes_left;
+
+uint8_t HalStorage::read(int address)
+{
+  return eeprom[address];
+}
+
+void HalStorage::update(int address, uint8_t value)
+{
+  // the real EEPROM also skips a byte that is already stored, so it is not counted
+  if (eeprom[address] == value || bytes_left == 0)
+  {
+    return;
+  }
+  if (bytes_left > 0)
+  {
+    bytes_left--;
+  }
+  eeprom[address] = value;
+}
+
+bool HalStorage::pending()
+{
+  return false;
+}
+
+void HalStorage::flush()
+{
+}
+
+int HalStorage::length()
+{
+  return sizeof(eeprom);
+}
+
+static HalStorage storage;
+
+//+ The data written for key in its generation-th write, different for every key and generation
+static void make_data(uint8_t key, uint16_t generation, uint8_t *data)
+{
+  data[0] = key;
+  data[1] = generation & 0xFF;
+  data[2] = generation >> 8;
+  data[3] = 0x5A ^ key ^ generation;
+}
+
+//+ Checks that key reads the data of the given generation
+static bool reads(EeJournal &log, uint8_t key, uint16_t generation)
+{
+  uint8_t expected[JOURNAL_DATA_SIZE];
+  uint8_t data[JOURNAL_DATA_SIZE];
+  make_data(key, generation, expected);
+  return log.read(key, data) && memcmp(data, expected, JOURNAL_DATA_SIZE) == 0;
+}
+
+//+ Writes every key once more, generation is counted up for each of them
+static void write_all(EeJournal &log, uint16_t *generation)
+{
+  for (uint8_t key = 0; key < KEYS; key++)
+  {
+    uint8_t data[JOURNAL_DATA_SIZE];
+    make_data(key, ++generation[key], data);
+    log.write(key, data);
+  }
+}
+
+/* The log state before the write that is cut short, copied back before every try */
+static uint8_t saved[sizeof(eeprom)];
+static uint16_t saved_generation[KEYS];
+
+//+ Writes key with the power cut after every possible number of bytes, checking each time that a new log reads all the
+// keys with their old data, or the new data for key, and that it carries on writing after the reboot
+static void check_cut_write(uint8_t key, uint16_t *generation)
+{
+  memcpy(saved, eeprom, sizeof(eeprom));
+  memcpy(saved_generation, generation, sizeof(saved_generation));
+
+  bool completed = false;
+  for (long cut = 0; !completed; cut++)
+  {
+    memcpy(eeprom, saved, sizeof(eeprom));
+    memcpy(generation, saved_generation, sizeof(saved_generation));
+
+    EeJournal before(storage, LOG_START, LOG_SIZE);
+    before.begin();
+    bytes_left = cut;
+    uint8_t data[JOURNAL_DATA_SIZE];
+    make_data(key, generation[key] + 1, data);
+    before.write(key, data);
+    completed = bytes_left != 0;
+    bytes_left = -1;
+
+    EeJournal after(storage, LOG_START, LOG_SIZE);
+    TEST_ASSERT_EQUAL(KEYS, after.begin());
+    for (uint8_t other = 0; other < KEYS; other++)
+    {
+      bool old_data = reads(after, other, generation[other]);
+      bool new_data = other == key && reads(after, other, generation[other] + 1);
+      TEST_ASSERT_TRUE_MESSAGE(old_data || new_data, "a key lost its data to a power cut");
+      if (new_data)
+      {
+        generation[other]++;
+      }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(!completed || reads(after, key, generation[key]), "a completed write was lost");
+
+    // the log has to stay usable: only key is written from here on, through both banks twice, so a key left behind
+    // in the bank the next compaction overwrites would be lost
+    for (uint8_t i = 0; i < 2 * 2 * LOG_SLOTS; i++)
+    {
+      make_data(key, ++generation[key], data);
+      after.write(key, data);
+    }
+    EeJournal again(storage, LOG_START, LOG_SIZE);
+    TEST_ASSERT_EQUAL(KEYS, again.begin());
+    for (uint8_t other = 0; other < KEYS; other++)
+    {
+      TEST_ASSERT_TRUE(reads(again, other, generation[other]));
+    }
+  }
+}
+
+void setUp()
+{
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  bytes_left = -1;
+}
+
+void tearDown()
+{
+}
+
+void test_blank_log_is_empty()
+{
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  uint8_t data[JOURNAL_DATA_SIZE];
+
+  TEST_ASSERT_EQUAL(0, log.begin());
+  TEST_ASSERT_FALSE(log.read(0, data));
+  TEST_ASSERT_EQUAL(LOG_SLOTS * 2, log.slots());
+  TEST_ASSERT_EQUAL(1, log.bank_passes(0));
+  TEST_ASSERT_EQUAL(0, log.bank_passes(1));
+}
+
+void test_keys_read_back_after_reboot()
+{
+  uint16_t generation[KEYS] = {};
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+  write_all(log, generation);
+  write_all(log, generation);
+
+  EeJournal after(storage, LOG_START, LOG_SIZE);
+  TEST_ASSERT_EQUAL(KEYS, after.begin());
+  for (uint8_t key = 0; key < KEYS; key++)
+  {
+    TEST_ASSERT_TRUE(reads(after, key, 2));
+  }
+}
+
+void test_unchanged_data_is_not_written()
+{
+  uint8_t data[JOURNAL_DATA_SIZE];
+  make_data(1, 1, data);
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+
+  log.write(1, data);
+  log.write(1, data);
+  TEST_ASSERT_EQUAL(1, log.writes());
+}
+
+void test_keys_beyond_max_are_dropped()
+{
+  uint8_t data[JOURNAL_DATA_SIZE];
+  make_data(0, 1, data);
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+
+  log.write(EeJournal::MAX_KEYS, data);
+  TEST_ASSERT_EQUAL(0, log.writes());
+  TEST_ASSERT_FALSE(log.read(EeJournal::MAX_KEYS, data));
+}
+
+void test_torn_record_is_rejected()
+{
+  uint16_t generation[KEYS] = {};
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+  write_all(log, generation);
+
+  check_cut_write(2, generation);
+}
+
+void test_torn_record_over_an_old_one_is_rejected()
+{
+  // the slot written next already holds a record from the pass before, a torn record is a mix of the two
+  uint16_t generation[KEYS] = {};
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+  for (uint8_t pass = 0; pass < 2 * LOG_SLOTS / KEYS + 1; pass++)
+  {
+    write_all(log, generation);
+  }
+  TEST_ASSERT_TRUE(log.bank_passes(0) > 1);
+
+  check_cut_write(4, generation);
+}
+
+void test_interrupted_compaction_is_recovered()
+{
+  // fills the first bank up to its last slot, so the next write compacts into the second one before it appends; the
+  // keys are written from the last one down, so the keys a cut compaction has not copied yet sit in the first slots,
+  // right where the compaction after the reboot starts writing
+  uint16_t generation[KEYS] = {};
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+  while (log.writes() < LOG_SLOTS)
+  {
+    uint8_t data[JOURNAL_DATA_SIZE];
+    uint8_t key = log.writes() < KEYS ? KEYS - 1 - log.writes() : 0;
+    make_data(key, ++generation[key], data);
+    log.write(key, data);
+  }
+  TEST_ASSERT_EQUAL(0, log.bank_passes(1));
+
+  check_cut_write(3, generation);
+}
+
+void test_interrupted_second_compaction_is_recovered()
+{
+  // the same in the other direction, the first bank now holds the records of the first pass; every record takes the
+  // next slot, compactions included, so the bank being written is full whenever the writes are a whole number of banks
+  uint16_t generation[KEYS] = {};
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+  while (log.bank_passes(1) == 0 || log.writes() % LOG_SLOTS != 0)
+  {
+    uint8_t data[JOURNAL_DATA_SIZE];
+    uint8_t key = log.writes() % KEYS;
+    make_data(key, ++generation[key], data);
+    log.write(key, data);
+  }
+
+  check_cut_write(5, generation);
+}
+
+void test_log_wraps_across_banks()
+{
+  uint16_t generation[KEYS] = {};
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+  for (uint16_t pass = 0; pass < 40; pass++)
+  {
+    write_all(log, generation);
+  }
+  TEST_ASSERT_TRUE(log.bank_passes(0) > 3);
+  TEST_ASSERT_TRUE(log.bank_passes(1) > 3);
+
+  // the passes are counted on the EEPROM and every slot of a bank is written once per pass
+  EeJournal after(storage, LOG_START, LOG_SIZE);
+  TEST_ASSERT_EQUAL(KEYS, after.begin());
+  TEST_ASSERT_EQUAL(log.bank_passes(0), after.bank_passes(0));
+  TEST_ASSERT_EQUAL(log.bank_passes(1), after.bank_passes(1));
+  for (uint8_t key = 0; key < KEYS; key++)
+  {
+    TEST_ASSERT_TRUE(reads(after, key, 40));
+  }
+
+  // nothing outside the log area is touched
+  for (uint8_t i = 0; i < LOG_START; i++)
+  {
+    TEST_ASSERT_EQUAL_HEX8(0xFF, eeprom[i]);
+  }
+}
+
+void test_sequence_numbers_wrap()
+{
+  // writes until the 16 bit sequence number rolls over, so one bank holds the records from just before it and the
+  // other the ones from just after, the newest records still win
+  uint16_t generation[KEYS] = {};
+  EeJournal log(storage, LOG_START, LOG_SIZE);
+  log.begin();
+  uint16_t written;
+  do
+  {
+    written = log.writes();
+    write_all(log, generation);
+  } while (log.writes() > written);
+  write_all(log, generation);
+
+  EeJournal after(storage, LOG_START, LOG_SIZE);
+  TEST_ASSERT_EQUAL(KEYS, after.begin());
+  for (uint8_t key = 0; key < KEYS; key++)
+  {
+    TEST_ASSERT_TRUE(reads(after, key, generation[key]));
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_blank_log_is_empty);
+  RUN_TEST(test_keys_read_back_after_reboot);
+  RUN_TEST(test_unchanged_data_is_not_written);
+  RUN_TEST(test_keys_beyond_max_are_dropped);
+  RUN_TEST(test_torn_record_is_rejected);
+  RUN_TEST(test_torn_record_over_an_old_one_is_rejected);
+  RUN_TEST(test_interrupted_compaction_is_recovered);
+  RUN_TEST(test_interrupted_second_compaction_is_recovered);
+  RUN_TEST(test_log_wraps_across_banks);
+  RUN_TEST(test_sequence_numbers_wrap);
+  return UNITY_END();
+}